@@ -0,0 +1,317 @@
+/*
+Benchmarks for the simulation's phases. Builds against main_sim.cpp itself, so it times exactly the code a run
+uses:
+
+    g++ -std=c++20 -O2 -pthread bench_sim.cpp -o evobench
+
+Each benchmark times one phase over a whole world of fixed-seed groups: playWithinGroup, haveChildren,
+playGroupGame, Group::updateGroupData, and a full generation (runGeneration, as main's loop runs it) for each
+engine. It does that for every combination of group count, mean group size and thread count on the grid, and
+prints one CSV row per combination with the throughput in agent-generations per second (one agent going
+through the phase once). Pass a previous output as --baseline and it also fails if anything got slower by more
+than --tolerance.
+*/
+
+#define EVOSIM_NO_MAIN
+#include "main_sim.cpp"
+
+#include <map>
+#include <tuple>
+
+const char* BENCH_HEADER = "benchmark,engine,groups,mean_group_size,threads,agents,repetitions,seconds,agent_generations_per_second";
+
+struct BenchOptions {
+    std::vector<long> groupCounts {100, 1000, 10000, 100000, 1000000};
+    std::vector<long> groupSizes {4, 20, 100, 1000, 10000};
+    std::vector<long> threadCounts {1};
+    std::uint64_t maxAgents = 20000000; //grid points with more agents than this are skipped
+    double minTime = 0.5; //seconds each benchmark runs for, at least
+    std::uint64_t seed = 1;
+    bool agents = true;
+    bool counts = true;
+    std::string only; //run just this benchmark
+};
+
+struct BenchResult {
+    std::string benchmark;
+    std::string engine;
+    long groups;
+    long groupSize;
+    long threads;
+    std::uint64_t agents;
+    long repetitions;
+    double seconds;
+    double throughput;
+};
+
+/*
+The starting world: the usual Poisson group sizes, but with a fixed mix of cooperators and spread-out
+institutions, so that every branch of the game gets exercised the way it is mid-run (a fresh world is all
+defectors with no institutions).
+*/
+template <typename GroupType>
+std::vector<GroupType> makeBenchWorld(const RunOptions& options) {
+    std::vector<GroupType> world = makeWorld<GroupType>(options);
+    for (GroupType& group : world) {
+        RandomStream rng (options.seed, 0, group.id, Phase::Sweep);
+        group.setInstitutions(rng.uniform() * 0.5f, rng.uniform() * 0.5f);
+        std::int64_t size ((std::int64_t) group.getSize());
+        std::int64_t cooperators (drawBinomial(size, 0.5, rng));
+        if constexpr (std::is_same_v<GroupType, CountGroup>) {
+            group.setCounts(cooperators, size - cooperators);
+        }
+        else {
+            for (std::int64_t i (0); i < size; ++i) {
+                group.updateTraitByIndex(i, i < cooperators ? COOPERATE : DEFECT);
+            }
+            group.updateComposition();
+        }
+    }
+    return world;
+}
+
+std::uint64_t countAgents(const auto& world) {
+    std::uint64_t total (0);
+    for (const auto& group : world) {
+        total += group.getSize();
+    }
+    return total;
+}
+
+/*
+Runs step(repetition) once to warm up (arenas and buffers grow to size), then repeatedly until minTime has
+passed, and reports the time per repetition.
+*/
+template <typename Step>
+BenchResult timeBenchmark(const BenchOptions& bench, std::uint64_t agents, Step&& step) {
+    step(0);
+    long repetitions (0);
+    auto start = std::chrono::steady_clock::now();
+    double elapsed (0);
+    while (elapsed < bench.minTime || repetitions == 0) {
+        step(++repetitions);
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    BenchResult result {};
+    result.agents = agents;
+    result.repetitions = repetitions;
+    result.seconds = elapsed / (double) repetitions;
+    result.throughput = (double) agents / result.seconds;
+    return result;
+}
+
+void runAgentBenchmarks(const BenchOptions& bench, const RunOptions& options, ThreadPool& pool, std::vector<BenchResult>& results) {
+    auto wanted = [&](const char* name) { return bench.only.empty() || bench.only == name; };
+    std::vector<Group> world = makeBenchWorld<Group>(options);
+    std::uint64_t agents (countAgents(world));
+
+    if (wanted("playWithinGroup")) {
+        results.push_back(timeBenchmark(bench, agents, [&](long r) {
+            pool.parallelFor(world.size(), [&](size_t k) {
+                RandomStream rng (options.seed, r, k, Phase::Play);
+                playWithinGroup(world[k], rng);
+            });
+        }));
+        results.back().benchmark = "playWithinGroup";
+    }
+    if (wanted("updateGroupData")) {
+        results.push_back(timeBenchmark(bench, agents, [&](long) {
+            pool.parallelFor(world.size(), [&](size_t k) {
+                world[k].updateGroupData();
+            });
+        }));
+        results.back().benchmark = "updateGroupData";
+    }
+    if (wanted("haveChildren")) {
+        //reproduction keeps every group's size, so the world stays the same size however often it runs
+        results.push_back(timeBenchmark(bench, agents, [&](long r) {
+            pool.parallelFor(world.size(), [&](size_t k) {
+                RandomStream rng (options.seed, r, k, Phase::Reproduce);
+                haveChildren(world[k], rng, options.params, options.reproductionMode);
+            });
+        }));
+        results.back().benchmark = "haveChildren";
+    }
+    if (wanted("playGroupGame")) {
+        //every group fights its neighbour; the total number of agents is conserved, so the count stays right
+        results.push_back(timeBenchmark(bench, agents, [&](long r) {
+            pool.parallelFor(world.size() / 2, [&](size_t k) {
+                RandomStream rng (options.seed, r, k, Phase::Conflict);
+                playGroupGame(world[2 * k], world[2 * k + 1], rng);
+            });
+        }));
+        results.back().benchmark = "playGroupGame";
+    }
+    for (size_t i (results.size()); i-- > 0 && results[i].engine.empty(); ) {
+        results[i].engine = "agents";
+    }
+}
+
+template <typename GroupType>
+void runGenerationBenchmark(const BenchOptions& bench, const RunOptions& options, ThreadPool& pool, const char* engine,
+                            std::vector<BenchResult>& results) {
+    if (!bench.only.empty() && bench.only != "generation") {
+        return;
+    }
+    std::vector<GroupType> world = makeBenchWorld<GroupType>(options);
+    WorldStatistics statistics;
+    statistics.rebuild(world);
+    results.push_back(timeBenchmark(bench, countAgents(world), [&](long r) {
+        runGeneration(world, (int) r, options.params.groupConflictChance, options, pool, statistics);
+    }));
+    results.back().benchmark = "generation";
+    results.back().engine = engine;
+}
+
+std::vector<long> parseList(const std::string& text) {
+    std::vector<long> values;
+    std::stringstream stream (text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back((long) std::stod(item)); //so 1e6 works
+    }
+    return values;
+}
+
+//reads rows written by an earlier run, keyed by everything but the measurements
+bool readBaseline(const std::string& path, std::map<std::string, double>& baseline) {
+    std::ifstream in (path);
+    if (!in) {
+        std::cerr << "Couldn't read baseline " << path << "\n";
+        return false;
+    }
+    std::string line;
+    std::getline(in, line);
+    while (std::getline(in, line)) {
+        std::vector<std::string> fields;
+        std::stringstream stream (line);
+        std::string field;
+        while (std::getline(stream, field, ',')) {
+            fields.push_back(field);
+        }
+        if (fields.size() == 9) {
+            baseline[fields[0] + "," + fields[1] + "," + fields[2] + "," + fields[3] + "," + fields[4]] = std::stod(fields[8]);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions bench;
+    bench.threadCounts = {(long) std::max(1u, std::thread::hardware_concurrency())};
+    std::string outputFile;
+    std::string baselineFile;
+    double tolerance (0.2);
+
+    for (int a (1); a < argc; ++a) {
+        std::string arg (argv[a]);
+        if (arg == "--groups" && a + 1 < argc) {
+            bench.groupCounts = parseList(argv[++a]);
+        }
+        else if (arg == "--sizes" && a + 1 < argc) {
+            bench.groupSizes = parseList(argv[++a]);
+        }
+        else if (arg == "--threads" && a + 1 < argc) {
+            bench.threadCounts = parseList(argv[++a]);
+        }
+        else if (arg == "--max-agents" && a + 1 < argc) {
+            bench.maxAgents = (std::uint64_t) std::stod(argv[++a]);
+        }
+        else if (arg == "--min-time" && a + 1 < argc) {
+            bench.minTime = std::stod(argv[++a]);
+        }
+        else if (arg == "--seed" && a + 1 < argc) {
+            bench.seed = std::stoull(argv[++a]);
+        }
+        else if (arg == "--engine" && a + 1 < argc) {
+            std::string engine (argv[++a]);
+            bench.agents = (engine != "counts");
+            bench.counts = (engine != "agents");
+        }
+        else if (arg == "--only" && a + 1 < argc) {
+            bench.only = argv[++a];
+        }
+        else if (arg == "--quick") {
+            bench.groupCounts = {100, 1000};
+            bench.groupSizes = {20, 100};
+            bench.minTime = 0.1;
+        }
+        else if (arg == "--output" && a + 1 < argc) {
+            outputFile = argv[++a];
+        }
+        else if (arg == "--baseline" && a + 1 < argc) {
+            baselineFile = argv[++a];
+        }
+        else if (arg == "--tolerance" && a + 1 < argc) {
+            tolerance = std::stod(argv[++a]);
+        }
+        else {
+            std::cerr << "Unknown argument " << arg << "\nUsage: " << argv[0]
+                      << " [--groups N,N,...] [--sizes N,N,...] [--threads N,N,...] [--max-agents N] [--min-time S]\n"
+                      << "    [--seed N] [--engine agents|counts|both] [--only BENCHMARK] [--quick]\n"
+                      << "    [--output FILE] [--baseline FILE] [--tolerance X]\n";
+            return 1;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (!baselineFile.empty() && !readBaseline(baselineFile, baseline)) {
+        return 1;
+    }
+
+    std::ofstream file;
+    if (!outputFile.empty()) {
+        file.open(outputFile);
+        if (!file) {
+            std::cerr << "Couldn't write " << outputFile << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = outputFile.empty() ? std::cout : file;
+    out << BENCH_HEADER << "\n";
+    std::cerr << "Kernels: " << activeKernels->name << "\n";
+
+    int regressions (0);
+    for (long threads : bench.threadCounts) {
+        ThreadPool pool ((unsigned) threads);
+        for (long groups : bench.groupCounts) {
+            for (long size : bench.groupSizes) {
+                if ((std::uint64_t) groups * (std::uint64_t) size > bench.maxAgents) {
+                    continue;
+                }
+                RunOptions options;
+                options.seed = bench.seed;
+                options.params.initialGroups = (int) groups;
+                options.params.agentsMultiplier = (int) size;
+
+                std::vector<BenchResult> results;
+                if (bench.agents) {
+                    runAgentBenchmarks(bench, options, pool, results);
+                    runGenerationBenchmark<Group>(bench, options, pool, "agents", results);
+                }
+                if (bench.counts) {
+                    runGenerationBenchmark<CountGroup>(bench, options, pool, "counts", results);
+                }
+
+                for (BenchResult& result : results) {
+                    result.groups = groups;
+                    result.groupSize = size;
+                    result.threads = threads;
+                    std::string key (result.benchmark + "," + result.engine + "," + std::to_string(groups) + ","
+                                     + std::to_string(size) + "," + std::to_string(threads));
+                    out << key << "," << result.agents << "," << result.repetitions << "," << result.seconds << ","
+                        << result.throughput << "\n";
+
+                    auto previous = baseline.find(key);
+                    if (previous != baseline.end() && result.throughput < previous->second * (1 - tolerance)) {
+                        std::cerr << "Regression: " << key << " went from " << previous->second << " to "
+                                  << result.throughput << " agent-generations/s\n";
+                        ++regressions;
+                    }
+                }
+                out.flush();
+            }
+        }
+    }
+    return regressions > 0 ? 1 : 0;
+}
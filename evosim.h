@@ -0,0 +1,132 @@
+/*
+The C API to the simulation, for driving it from other programs (analysis tools, Python through ctypes or
+cffi, R, ...) without going through the command line and the CSV. Build the library from the same source as
+the program:
+
+    g++ -std=c++20 -O2 -pthread -shared -fPIC -fvisibility=hidden evosim_api.cpp -o libevosim.so
+
+and link against it with -levosim. A world is made with evosim_create, stepped with evosim_step, and read
+through evosim_get_stats and the per-group column pointers, which point straight into the library's memory:
+they stay valid (and unchanged) until the next evosim_step, evosim_set_param or evosim_destroy on that world.
+A world may be used from one thread at a time; different worlds are independent.
+
+Functions that can fail return EVOSIM_OK or a negative evosim_status, or NULL, and evosim_last_error says
+what went wrong (on the calling thread, until its next failure). The structs start with their own size,
+filled in by the _init functions, so that fields can be added at the end without breaking programs built
+against an older header.
+*/
+
+#ifndef EVOSIM_H
+#define EVOSIM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#define EVOSIM_API __declspec(dllexport)
+#else
+#define EVOSIM_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EVOSIM_API_VERSION 1
+
+typedef enum evosim_status {
+    EVOSIM_OK = 0,
+    EVOSIM_ERROR_ARGUMENT = -1, /* a bad argument, or a setting the world doesn't have */
+    EVOSIM_ERROR_MEMORY = -2,
+    EVOSIM_ERROR_STATE = -3, /* not possible in the world's current state, e.g. stepping past its last generation */
+    EVOSIM_ERROR_SYSTEM = -4 /* the system refused something else the library needed, e.g. starting its threads */
+} evosim_status;
+
+typedef enum evosim_engine {
+    EVOSIM_ENGINE_AGENTS = 0, /* the per-agent engine, the reference */
+    EVOSIM_ENGINE_COUNTS = 1 /* cooperator and defector counts per group; prisoner's dilemma only */
+} evosim_engine;
+
+typedef enum evosim_game {
+    EVOSIM_GAME_PRISONERS_DILEMMA = 0,
+    EVOSIM_GAME_LONERS = 1,
+    EVOSIM_GAME_PUNISHERS = 2
+} evosim_game;
+
+typedef struct evosim_config {
+    uint32_t size; /* sizeof(evosim_config), set by evosim_config_init */
+    uint64_t seed;
+    int32_t generations; /* length of the conflict chance series, as --generations; 0 makes it as the run goes, as --streaming */
+    int32_t threads; /* 0 for all cores */
+    int32_t engine; /* evosim_engine */
+    int32_t game; /* evosim_game */
+    int32_t binomial_reproduction; /* as --reproduction binomial */
+    int32_t skip_ahead; /* as --skip-ahead on */
+    double conflict_chance;
+    double mutation_rate;
+    double institution_chance;
+    int32_t groups;
+    int32_t agents; /* mean group size */
+} evosim_config;
+
+/* the world averages and distributions as of the last generation played */
+typedef struct evosim_stats {
+    uint32_t size; /* sizeof(evosim_stats), set by evosim_stats_init */
+    int64_t generation; /* generations played so far */
+    float coop; /* mean over groups of the cooperator share, as the CSV's Proportion of Cooperators */
+    float tax_rate;
+    float seg_rate;
+    float conflict_chance; /* of the last generation */
+    float agent_coop; /* cooperators over all agents */
+    uint32_t size_quantiles[5]; /* min, 10%, median, 90% and max group size */
+    uint32_t institutions[11][6]; /* groups per tax rate (0, 0.1, ..., 1) and segmentation rate (0, ..., 0.5) */
+} evosim_stats;
+
+/* one group's members: its packed strategy codes and payoffs, read-only, as evosim_get_members gives them */
+typedef struct evosim_members {
+    uint32_t size; /* sizeof(evosim_members), set by evosim_members_init */
+    uint64_t count; /* agents in the group */
+    uint32_t bits_per_agent; /* agent i's strategy is bits [b*i, b*(i+1)) of the words, counting from bit 0 of word 0 */
+    const uint64_t* strategy_words;
+    const float* payoffs; /* always 0 between steps: a step ends with the children, who haven't played yet;
+                             the game's results are in evosim_group_total_payoff */
+} evosim_members;
+
+EVOSIM_API int evosim_api_version(void);
+EVOSIM_API const char* evosim_last_error(void);
+
+/* the command line's defaults */
+EVOSIM_API void evosim_config_init(evosim_config* config);
+EVOSIM_API void evosim_stats_init(evosim_stats* stats);
+EVOSIM_API void evosim_members_init(evosim_members* members);
+
+typedef struct evosim_world evosim_world;
+
+EVOSIM_API evosim_world* evosim_create(const evosim_config* config);
+EVOSIM_API void evosim_destroy(evosim_world* world);
+
+/* plays the next n generations */
+EVOSIM_API int evosim_step(evosim_world* world, int64_t n);
+
+/* changes a parameter from the next generation on; names as the command line flags (mutation-rate,
+   institution-chance, conflict-chance). groups and agents are fixed once the world exists. */
+EVOSIM_API int evosim_set_param(evosim_world* world, const char* name, double value);
+
+EVOSIM_API int evosim_get_stats(const evosim_world* world, evosim_stats* stats);
+
+/* per-group columns indexed by group id, each evosim_group_count long */
+EVOSIM_API size_t evosim_group_count(const evosim_world* world);
+EVOSIM_API const float* evosim_group_coop(evosim_world* world);
+EVOSIM_API const float* evosim_group_tax_rate(evosim_world* world);
+EVOSIM_API const float* evosim_group_seg_rate(evosim_world* world);
+EVOSIM_API const float* evosim_group_total_payoff(evosim_world* world);
+EVOSIM_API const uint32_t* evosim_group_size(evosim_world* world);
+
+/* the members of group id; the per-agent engine only */
+EVOSIM_API int evosim_get_members(const evosim_world* world, size_t id, evosim_members* members);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,358 @@
+/*
+The C API of evosim.h. Like the benchmarks, it builds against main_sim.cpp itself, so a library world runs
+exactly the code the program does (the same seed and settings give the same generations as the command line):
+
+    g++ -std=c++20 -O2 -pthread -shared -fPIC -fvisibility=hidden evosim_api.cpp -o libevosim.so
+
+EVOSIM_LIBRARY leaves out main and the program's counting operator new, which a library has no business
+installing in its host. Everything but the evosim_ functions stays hidden, and no exception gets out of them:
+every entry point that can throw goes through guarded(), which turns whatever was thrown into a status (or
+NULL) and evosim_last_error.
+*/
+
+#define EVOSIM_NO_MAIN
+#define EVOSIM_LIBRARY
+#include "main_sim.cpp"
+
+#include "evosim.h"
+
+namespace {
+
+thread_local std::string lastError;
+
+int fail(int status, const char* message) {
+    try {
+        lastError = message;
+    }
+    catch (...) {
+        lastError.clear(); //no room even for the message
+    }
+    return status;
+}
+
+int fail(int status, const std::string& message) {
+    return fail(status, message.c_str());
+}
+
+//runs an entry point's body, turning anything it throws into a failure status
+template <typename Body>
+int guarded(Body&& body) {
+    try {
+        return body();
+    }
+    catch (const std::bad_alloc&) {
+        return fail(EVOSIM_ERROR_MEMORY, "out of memory");
+    }
+    catch (const std::exception& error) {
+        return fail(EVOSIM_ERROR_SYSTEM, error.what());
+    }
+    catch (...) {
+        return fail(EVOSIM_ERROR_SYSTEM, "unexpected failure inside the library");
+    }
+}
+
+/*
+A world behind the C handle. WorldState is what evosim.h sees; BasicWorldState is the world loop for one
+group type, picked with withGroupType when the world is made.
+*/
+class WorldState {
+public:
+    virtual ~WorldState() = default;
+    virtual int step(std::int64_t n) = 0;
+    virtual int setParam(const std::string& name, double value) = 0;
+    virtual void stats(evosim_stats& out) const = 0;
+    virtual size_t groupCount() const = 0;
+    virtual const GenerationRecord& columns() = 0;
+    virtual int members(size_t id, evosim_members& out) const = 0;
+};
+
+template <typename GroupType>
+class BasicWorldState : public WorldState {
+public:
+    BasicWorldState(const RunOptions& options, int generations, unsigned threads)
+        : options(options), generations(generations), pool(threads),
+          conflictChance(options.seed, generations, options.params.groupConflictChance, generations == 0) {
+        world = makeWorld<GroupType>(options);
+        statistics.rebuild(world);
+        columnData.propCoop.resize(world.size());
+        columnData.taxRate.resize(world.size());
+        columnData.segRate.resize(world.size());
+        columnData.size.resize(world.size());
+        columnData.totalPayoff.resize(world.size());
+    }
+
+    int step(std::int64_t n) override {
+        if (n < 0) {
+            return fail(EVOSIM_ERROR_ARGUMENT, "can't step a negative number of generations");
+        }
+        if (generations > 0 && next + n > generations) {
+            return fail(EVOSIM_ERROR_STATE, "the world only has " + std::to_string(generations) + " generations");
+        }
+        for (std::int64_t i (0); i < n; ++i, ++next) {
+            lastChance = conflictChance[(int) next];
+            runGeneration(world, (int) next, lastChance, options, pool, statistics);
+        }
+        columnsStale = true;
+        return EVOSIM_OK;
+    }
+
+    int setParam(const std::string& name, double value) override {
+        if (name == "groups" || name == "agents") {
+            return fail(EVOSIM_ERROR_STATE, name + " is fixed once the world exists");
+        }
+        if (!::setParam(options.params, name, value)) {
+            return fail(EVOSIM_ERROR_ARGUMENT, "no parameter called " + name);
+        }
+        if (name == "conflict-chance") {
+            conflictChance.setBaseChance(options.params.groupConflictChance);
+        }
+        return EVOSIM_OK;
+    }
+
+    void stats(evosim_stats& out) const override {
+        WorldStats averages (statistics.summary());
+        WorldDistribution distribution;
+        statistics.distribution(distribution);
+        out.generation = next;
+        out.coop = averages.pCoop;
+        out.tax_rate = averages.avgTRate;
+        out.seg_rate = averages.avgSRate;
+        out.conflict_chance = lastChance;
+        out.agent_coop = distribution.agentCoop;
+        std::copy(std::begin(distribution.sizeQuantiles), std::end(distribution.sizeQuantiles), out.size_quantiles);
+        std::memcpy(out.institutions, distribution.institutions, sizeof(out.institutions));
+    }
+
+    size_t groupCount() const override {
+        return world.size();
+    }
+
+    //brought up to date on the first request after a step, rather than every generation
+    const GenerationRecord& columns() override {
+        if (columnsStale) {
+            fillRecord(columnData, world, true);
+            columnsStale = false;
+        }
+        return columnData;
+    }
+
+    int members(size_t id, evosim_members& out) const override {
+        if (id >= world.size()) {
+            return fail(EVOSIM_ERROR_ARGUMENT, "no group " + std::to_string(id));
+        }
+        if constexpr (std::is_same_v<GroupType, CountGroup>) {
+            return fail(EVOSIM_ERROR_STATE, "the count engine doesn't keep members");
+        }
+        else {
+            const auto& agents = world[id].getAgents();
+            out.count = agents.size();
+            out.bits_per_agent = (std::uint32_t) std::remove_cvref_t<decltype(agents)>::BITS;
+            out.strategy_words = agents.traitWords().data();
+            out.payoffs = agents.payoffs().data();
+            return EVOSIM_OK;
+        }
+    }
+
+private:
+    RunOptions options;
+    int generations;
+    ThreadPool pool;
+    ConflictChanceSeries conflictChance;
+    std::vector<GroupType> world;
+    WorldStatistics statistics;
+    std::int64_t next = 0; //the next generation to play
+    float lastChance = 0;
+    GenerationRecord columnData;
+    bool columnsStale = true;
+};
+
+}
+
+struct evosim_world {
+    std::unique_ptr<WorldState> state;
+};
+
+//a struct from an older header is shorter; copy back only what it has room for
+template <typename Struct>
+void copyOut(const Struct& full, Struct* out) {
+    std::uint32_t room (std::min<std::uint32_t>(out->size, sizeof(Struct)));
+    std::memcpy(reinterpret_cast<char*>(out) + sizeof(std::uint32_t), reinterpret_cast<const char*>(&full) + sizeof(std::uint32_t),
+                room - sizeof(std::uint32_t));
+}
+
+//one of the per-group columns, brought up to date first; NULL if that fails
+template <typename Column>
+auto groupColumn(evosim_world* world, Column&& column) -> decltype(column(world->state->columns())) {
+    decltype(column(world->state->columns())) data = nullptr;
+    if (world == nullptr) {
+        fail(EVOSIM_ERROR_ARGUMENT, "no world");
+        return data;
+    }
+    guarded([&] {
+        data = column(world->state->columns());
+        return EVOSIM_OK;
+    });
+    return data;
+}
+
+extern "C" {
+
+int evosim_api_version(void) {
+    return EVOSIM_API_VERSION;
+}
+
+const char* evosim_last_error(void) {
+    return lastError.c_str();
+}
+
+void evosim_config_init(evosim_config* config) {
+    RunOptions defaults;
+    *config = evosim_config {};
+    config->size = sizeof(evosim_config);
+    config->seed = 1;
+    config->generations = 1000;
+    config->engine = EVOSIM_ENGINE_AGENTS;
+    config->game = EVOSIM_GAME_PRISONERS_DILEMMA;
+    config->skip_ahead = defaults.skipAhead ? 1 : 0;
+    config->conflict_chance = defaults.params.groupConflictChance;
+    config->mutation_rate = defaults.params.individualMutationRate;
+    config->institution_chance = defaults.params.institutionalChangeChance;
+    config->groups = defaults.params.initialGroups;
+    config->agents = defaults.params.agentsMultiplier;
+}
+
+void evosim_stats_init(evosim_stats* stats) {
+    *stats = evosim_stats {};
+    stats->size = sizeof(evosim_stats);
+}
+
+void evosim_members_init(evosim_members* members) {
+    *members = evosim_members {};
+    members->size = sizeof(evosim_members);
+}
+
+evosim_world* evosim_create(const evosim_config* config) {
+    if (config == nullptr || config->size < sizeof(std::uint32_t)) {
+        fail(EVOSIM_ERROR_ARGUMENT, "no config; fill one in with evosim_config_init");
+        return nullptr;
+    }
+    //fields a caller's older, shorter config doesn't have keep their defaults
+    evosim_config full;
+    evosim_config_init(&full);
+    std::memcpy(reinterpret_cast<char*>(&full) + sizeof(std::uint32_t), reinterpret_cast<const char*>(config) + sizeof(std::uint32_t),
+                std::min<size_t>(config->size, sizeof(full)) - sizeof(std::uint32_t));
+
+    if (full.engine != EVOSIM_ENGINE_AGENTS && full.engine != EVOSIM_ENGINE_COUNTS) {
+        fail(EVOSIM_ERROR_ARGUMENT, "unknown engine");
+        return nullptr;
+    }
+    if (full.game < EVOSIM_GAME_PRISONERS_DILEMMA || full.game > EVOSIM_GAME_PUNISHERS) {
+        fail(EVOSIM_ERROR_ARGUMENT, "unknown game");
+        return nullptr;
+    }
+    if (full.engine == EVOSIM_ENGINE_COUNTS && full.game != EVOSIM_GAME_PRISONERS_DILEMMA) {
+        fail(EVOSIM_ERROR_ARGUMENT, "the count engine only plays the prisoner's dilemma");
+        return nullptr;
+    }
+    if (full.generations < 0 || full.groups <= 0 || full.agents <= 0) {
+        fail(EVOSIM_ERROR_ARGUMENT, "generations, groups and agents can't be negative, and there has to be a group");
+        return nullptr;
+    }
+
+    RunOptions options;
+    options.seed = full.seed;
+    options.params.groupConflictChance = (float) full.conflict_chance;
+    options.params.individualMutationRate = (float) full.mutation_rate;
+    options.params.institutionalChangeChance = (float) full.institution_chance;
+    options.params.initialGroups = full.groups;
+    options.params.agentsMultiplier = full.agents;
+    options.reproductionMode = full.binomial_reproduction ? ReproductionMode::Binomial : ReproductionMode::Alias;
+    options.skipAhead = full.skip_ahead != 0;
+    options.streaming = full.generations == 0;
+    options.game = (GameKind) full.game;
+    unsigned threads (full.threads > 0 ? (unsigned) full.threads : std::max(1u, std::thread::hardware_concurrency()));
+
+    evosim_world* made = nullptr;
+    guarded([&] {
+        auto world = std::make_unique<evosim_world>();
+        withGroupType(full.engine == EVOSIM_ENGINE_COUNTS, options.game, [&](auto type) {
+            world->state = std::make_unique<BasicWorldState<typename decltype(type)::type>>(options, full.generations, threads);
+            return true;
+        });
+        made = world.release();
+        return EVOSIM_OK;
+    });
+    return made;
+}
+
+void evosim_destroy(evosim_world* world) {
+    delete world;
+}
+
+int evosim_step(evosim_world* world, int64_t n) {
+    if (world == nullptr) {
+        return fail(EVOSIM_ERROR_ARGUMENT, "no world");
+    }
+    return guarded([&] { return world->state->step(n); });
+}
+
+int evosim_set_param(evosim_world* world, const char* name, double value) {
+    if (world == nullptr || name == nullptr) {
+        return fail(EVOSIM_ERROR_ARGUMENT, "no world or parameter name");
+    }
+    return guarded([&] { return world->state->setParam(name, value); });
+}
+
+int evosim_get_stats(const evosim_world* world, evosim_stats* stats) {
+    if (world == nullptr || stats == nullptr || stats->size < sizeof(std::uint32_t)) {
+        return fail(EVOSIM_ERROR_ARGUMENT, "no world, or a stats struct not set up with evosim_stats_init");
+    }
+    return guarded([&] {
+        evosim_stats full;
+        evosim_stats_init(&full);
+        world->state->stats(full);
+        copyOut(full, stats);
+        return EVOSIM_OK;
+    });
+}
+
+size_t evosim_group_count(const evosim_world* world) {
+    return world != nullptr ? world->state->groupCount() : 0;
+}
+
+const float* evosim_group_coop(evosim_world* world) {
+    return groupColumn(world, [](const GenerationRecord& columns) { return columns.propCoop.data(); });
+}
+
+const float* evosim_group_tax_rate(evosim_world* world) {
+    return groupColumn(world, [](const GenerationRecord& columns) { return columns.taxRate.data(); });
+}
+
+const float* evosim_group_seg_rate(evosim_world* world) {
+    return groupColumn(world, [](const GenerationRecord& columns) { return columns.segRate.data(); });
+}
+
+const float* evosim_group_total_payoff(evosim_world* world) {
+    return groupColumn(world, [](const GenerationRecord& columns) { return columns.totalPayoff.data(); });
+}
+
+const uint32_t* evosim_group_size(evosim_world* world) {
+    return groupColumn(world, [](const GenerationRecord& columns) { return columns.size.data(); });
+}
+
+int evosim_get_members(const evosim_world* world, size_t id, evosim_members* members) {
+    if (world == nullptr || members == nullptr || members->size < sizeof(std::uint32_t)) {
+        return fail(EVOSIM_ERROR_ARGUMENT, "no world, or a members struct not set up with evosim_members_init");
+    }
+    return guarded([&] {
+        evosim_members full;
+        evosim_members_init(&full);
+        int status (world->state->members(id, full));
+        if (status == EVOSIM_OK) {
+            copyOut(full, members);
+        }
+        return status;
+    });
+}
+
+}
@@ -4,50 +4,502 @@ https://sites.santafe.edu/~bowles/artificial_history/algorithm_coevolution.htm
 */
 
 #include <iostream>
+#include <string>
 #include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
 #include <random>
 #include <vector>
 #include <numeric>
+#include <limits>
 #include <algorithm>
 #include <iterator>
 #include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <bit>
+#include <span>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <type_traits>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <new>
+#include <memory>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define EVOSIM_HAVE_AVX2 1
+#include <immintrin.h>
+#else
+#define EVOSIM_HAVE_AVX2 0
+#endif
+
+/*
+Heap allocation counter. Every operator new in the program goes through here, so we can check that a
+steady-state generation really doesn't allocate (see --count-allocations). It's two relaxed atomic adds per
+allocation, and the point of the exercise is that there aren't any in the hot loop. The library build
+(EVOSIM_LIBRARY, see evosim_api.cpp) leaves the host program's operator new alone, so there the counts stay 0.
+*/
+std::atomic<std::uint64_t> heapAllocations {0};
+std::atomic<std::uint64_t> heapAllocatedBytes {0};
+
+#ifndef EVOSIM_LIBRARY
+
+void* countedAllocate(std::size_t size) {
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    heapAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    void* memory = std::malloc(size > 0 ? size : 1);
+    if (memory == nullptr) {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void* operator new(std::size_t size) {
+    return countedAllocate(size);
+}
+
+void* operator new[](std::size_t size) {
+    return countedAllocate(size);
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+#endif //EVOSIM_LIBRARY
+
+/*
+Telemetry, for seeing where the time goes as a run goes on (group sizes drift, so the phases' costs do too).
+It is compiled in only with -DEVOSIM_TELEMETRY=1, and then turned on with --telemetry FILE (a CSV row per
+generation) and/or --trace FILE (Chrome trace event JSON, for chrome://tracing or Perfetto). Without the flag
+the macros below are empty and none of it is in the binary.
+
+Each thread adds up its own phase times and random words in a TelemetrySlot, so the groups' threads never
+share a counter; the main thread adds the slots up once a generation. Play and reproduction run on every
+thread, so their times are CPU time summed over threads; the other phases are wall time on the main thread.
+*/
+
+#ifndef EVOSIM_TELEMETRY
+#define EVOSIM_TELEMETRY 0
+#endif
+
+enum class TracePhase : int {
+    WithinGroup = 0, //the whole parallel within-group step, wall time
+    Play = 1, //playWithinGroup, summed over threads
+    Reproduce = 2, //haveChildren, summed over threads
+    Shuffle = 3, //shuffling the world and drawing the war size
+    War = 4,
+    Statistics = 5,
+    Output = 6 //handing the record to the writer, and checkpoints
+};
+
+const int NUM_TRACE_PHASES = 7;
+const char* TRACE_PHASE_NAMES[NUM_TRACE_PHASES] = {"within_group", "play", "reproduce", "shuffle", "war", "statistics", "output"};
+
+#if EVOSIM_TELEMETRY
+
+struct alignas(64) TelemetrySlot {
+    std::uint64_t phaseNanos[NUM_TRACE_PHASES] = {};
+    std::uint64_t lastStart[NUM_TRACE_PHASES] = {}; //when the phase last started, for the trace
+    std::uint64_t rngWords = 0;
+};
+
+//threads past the last slot share it, so counts from them can race; that's a lot of threads
+const int MAX_TELEMETRY_THREADS = 256;
+TelemetrySlot telemetrySlots[MAX_TELEMETRY_THREADS];
+std::atomic<int> telemetryThreads {0};
+bool telemetryEnabled = false;
+
+TelemetrySlot& telemetrySlot() {
+    thread_local TelemetrySlot* slot = &telemetrySlots[std::min(telemetryThreads.fetch_add(1), MAX_TELEMETRY_THREADS - 1)];
+    return *slot;
+}
+
+std::uint64_t telemetryClock() {
+    return (std::uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class PhaseTimer {
+public:
+    explicit PhaseTimer(TracePhase p) : phase((int) p), start(telemetryEnabled ? telemetryClock() : 0) {}
+
+    ~PhaseTimer() {
+        if (telemetryEnabled) {
+            TelemetrySlot& slot = telemetrySlot();
+            slot.phaseNanos[phase] += telemetryClock() - start;
+            slot.lastStart[phase] = start;
+        }
+    }
+
+private:
+    int phase;
+    std::uint64_t start;
+};
+
+#define EVOSIM_TIME_PHASE(phase) PhaseTimer phaseTimer (phase)
+#define EVOSIM_COUNT_RNG(words) if (telemetryEnabled) { telemetrySlot().rngWords += (words); }
+
+#else
+
+#define EVOSIM_TIME_PHASE(phase)
+#define EVOSIM_COUNT_RNG(words)
+
+#endif //EVOSIM_TELEMETRY
 
 /*
-Storage place for our beautiful boys (aka global constants)
+Storage place for our beautiful boys. The ones we do parameter searches over are in Params and can be set from
+the command line (or swept, see runSweep); the defaults are the BCH benchmark values.
 */
-const float GROUP_CONFLICT_CHANCE (0.25); //value from BCH. We may need to have this vary over time, see fig 5
-const float INDIVIDUAL_MUTATION_RATE (0.005); //benchmark from BCH, will need to do parameter search
-const float INSTITUTIONAL_CHANGE_CHANCE (0.1); //benchmark from BCH
-const int INITIAL_GROUPS = 100; //I randomly chose ten. We can change this later
-const int AGENTS_MULTIPLIER = 20; //benchmark value is this is 20
+struct Params {
+    float groupConflictChance = 0.25; //value from BCH. We may need to have this vary over time, see fig 5
+    float individualMutationRate = 0.005; //benchmark from BCH, will need to do parameter search
+    float institutionalChangeChance = 0.1; //benchmark from BCH
+    int initialGroups = 100; //I randomly chose ten. We can change this later
+    int agentsMultiplier = 20; //benchmark value is this is 20
+};
+
 const int GROUP_SIZE_LOWER_BOUND = 4; //from BCH. Makes sense because that way there are 2 PD pairings
 
+/*
+Prisoner's dilemma payoffs. I chose smallish values because some of the transition
+probabilities Bowles describes look small and I want to make sure payoffs don't overwhelm mutations.
+*/
+constexpr float SUCKERS_PAYOFF = 0; //S
+constexpr float TEMPTATION_TO_DEFECT = 1; //T
+constexpr float REWARD_FOR_COOPERATION = 0.6; //R
+constexpr float MUTUAL_PUNISHMENT = 0.3; //P
+
+constexpr float LONER_PAYOFF = 0.45; //what a loner and whoever it's paired with get; between P and R, see Hauert et al. 2002
+constexpr float PUNISHMENT_FINE = 0.5; //taken off a defector paired with a punisher
+constexpr float PUNISHMENT_COST = 0.1; //and what fining it costs the punisher
+
+/*
+Games. A strategy is a small integer code and a game policy says how many strategies there are, what each earns
+against each other one (PAYOFF[mine][theirs]) and which of them count as cooperators for a group's proportion
+of cooperators. Everything that touches agents is a template on the policy, so each game is compiled with its
+payoff matrix and strategy count as constants and nothing branches on traits at run time. Codes 0 and 1 are
+always defect and cooperate; games with more strategies number theirs from 2. Pick one with --game.
+*/
+using Trait = std::uint8_t;
+const Trait DEFECT = 0;
+const Trait COOPERATE = 1;
+
+enum class GameKind {
+    PrisonersDilemma,
+    Loners,
+    Punishers
+};
+
+struct PrisonersDilemma {
+    static constexpr GameKind KIND = GameKind::PrisonersDilemma;
+    static constexpr int STRATEGIES = 2;
+    static constexpr float PAYOFF[2][2] = {
+        {MUTUAL_PUNISHMENT, TEMPTATION_TO_DEFECT},
+        {SUCKERS_PAYOFF, REWARD_FOR_COOPERATION}};
+    static constexpr bool COOPERATES[2] = {false, true};
+};
+
+//the optional prisoner's dilemma: loners (2) won't play, and they and their partner get the loner's payoff
+struct LonersGame {
+    static constexpr GameKind KIND = GameKind::Loners;
+    static constexpr int STRATEGIES = 3;
+    static constexpr float PAYOFF[3][3] = {
+        {MUTUAL_PUNISHMENT, TEMPTATION_TO_DEFECT, LONER_PAYOFF},
+        {SUCKERS_PAYOFF, REWARD_FOR_COOPERATION, LONER_PAYOFF},
+        {LONER_PAYOFF, LONER_PAYOFF, LONER_PAYOFF}};
+    static constexpr bool COOPERATES[3] = {false, true, false};
+};
+
+//punishers (2) cooperate, and fine a defecting partner at a cost to themselves
+struct PunishersGame {
+    static constexpr GameKind KIND = GameKind::Punishers;
+    static constexpr int STRATEGIES = 3;
+    static constexpr float PAYOFF[3][3] = {
+        {MUTUAL_PUNISHMENT, TEMPTATION_TO_DEFECT, TEMPTATION_TO_DEFECT - PUNISHMENT_FINE},
+        {SUCKERS_PAYOFF, REWARD_FOR_COOPERATION, REWARD_FOR_COOPERATION},
+        {SUCKERS_PAYOFF - PUNISHMENT_COST, REWARD_FOR_COOPERATION, REWARD_FOR_COOPERATION}};
+    static constexpr bool COOPERATES[3] = {false, true, true};
+};
+
+//bits per agent in the packed trait words: the smallest power of two that holds every code
+template <typename Game>
+constexpr int TRAIT_BITS = Game::STRATEGIES <= 2 ? 1 : Game::STRATEGIES <= 4 ? 2 : 4;
+
+/*
+Random numbers. Every draw comes from a counter-based generator (Philox4x32-10, Salmon et al. 2011):
+the output is a pure function of a key (the run seed) and a counter (generation, group, phase, position),
+so there is no big state to seed per group and any group's draws for any generation can be reproduced
+without replaying the ones before it, whichever order or thread they end up being run on.
+*/
+
+enum class Phase : std::uint32_t {
+    Setup = 0, //initial group sizes
+    ConflictChance = 1, //the auto-regressive conflict chance series
+    Play = 2, //pairing inside a group
+    Reproduce = 3, //choosing parents, mutation and institutional change
+    War = 4, //deciding who fights
+    Conflict = 5, //splitting the pool after a conflict, one stream per pair
+    Sweep = 6 //placing Latin hypercube points
+};
+
+class RandomStream {
+public:
+    using result_type = std::uint32_t;
+
+    RandomStream(std::uint64_t seed, std::uint32_t generation, std::uint32_t groupId, Phase phase) {
+        key[0] = (std::uint32_t) seed;
+        key[1] = (std::uint32_t) (seed >> 32);
+        counter[0] = 0;
+        counter[1] = generation;
+        counter[2] = groupId;
+        counter[3] = (std::uint32_t) phase;
+        position = 4; //nothing buffered yet
+    }
+
+    static constexpr result_type min() {
+        return 0;
+    }
+
+    static constexpr result_type max() {
+        return 0xFFFFFFFFu;
+    }
+
+    result_type operator()() {
+        if (position == 4) {
+            refill();
+        }
+        return buffer[position++];
+    }
+
+    //uniform on [0, 1) with 24 bits, which is all a float can hold anyway
+    float uniform() {
+        return (float) ((*this)() >> 8) * 0x1p-24f;
+    }
+
+    //uniform integer on [0, n), Lemire's multiply-and-reject so there's no modulo bias
+    std::uint32_t below(std::uint32_t n) {
+        std::uint64_t product = (std::uint64_t) (*this)() * n;
+        std::uint32_t low = (std::uint32_t) product;
+        if (low < n) {
+            std::uint32_t threshold = (0u - n) % n;
+            while (low < threshold) {
+                product = (std::uint64_t) (*this)() * n;
+                low = (std::uint32_t) product;
+            }
+        }
+        return (std::uint32_t) (product >> 32);
+    }
+
+private:
+    std::uint32_t key[2];
+    std::uint32_t counter[4];
+    std::uint32_t buffer[4];
+    int position;
+
+    static void mulhilo(std::uint32_t a, std::uint32_t b, std::uint32_t& hi, std::uint32_t& lo) {
+        std::uint64_t product = (std::uint64_t) a * b;
+        hi = (std::uint32_t) (product >> 32);
+        lo = (std::uint32_t) product;
+    }
+
+    void refill() {
+        std::uint32_t c0 (counter[0]), c1 (counter[1]), c2 (counter[2]), c3 (counter[3]);
+        std::uint32_t k0 (key[0]), k1 (key[1]);
+        for (int round (0); round < 10; ++round) {
+            std::uint32_t hi0, lo0, hi1, lo1;
+            mulhilo(0xD2511F53u, c0, hi0, lo0);
+            mulhilo(0xCD9E8D57u, c2, hi1, lo1);
+            c0 = hi1 ^ c1 ^ k0;
+            c1 = lo1;
+            c2 = hi0 ^ c3 ^ k1;
+            c3 = lo0;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        buffer[0] = c0;
+        buffer[1] = c1;
+        buffer[2] = c2;
+        buffer[3] = c3;
+        ++counter[0];
+        position = 0;
+        EVOSIM_COUNT_RNG(4);
+    }
+};
+
+//Fisher-Yates with our own bounded draws, so the permutation doesn't depend on the standard library
+template <typename T>
+void shuffleRange(T* first, size_t length, RandomStream& rng) {
+    for (size_t i (length); i > 1; --i) {
+        size_t j (rng.below((std::uint32_t) i));
+        std::swap(first[i - 1], first[j]);
+    }
+}
+
+/*
+Discrete distributions for the count engine, which draws whole pools at once instead of walking agents.
+Binomial is the standard library's (constant expected time for large n). The standard library has no
+hypergeometric, so that one is ours: a short sequential draw when the sample is small and Stadlober's
+ratio-of-uniforms (HRUA, as used by numpy) otherwise, which takes constant expected time however big the
+population is.
+*/
+
+std::int64_t drawBinomial(std::int64_t trials, double p, RandomStream& rng) {
+    if (trials <= 0 || p <= 0) {
+        return 0;
+    }
+    if (p >= 1) {
+        return trials;
+    }
+    std::binomial_distribution<std::int64_t> binomial (trials, p);
+    return binomial(rng);
+}
+
+double logFactorial(std::int64_t k) {
+    static const std::vector<double> table = [] {
+        std::vector<double> values (126);
+        values[0] = 0;
+        for (size_t i (1); i < values.size(); ++i) {
+            values[i] = values[i - 1] + std::log((double) i);
+        }
+        return values;
+    }();
+    if (k < (std::int64_t) table.size()) {
+        return table[k];
+    }
+    //Stirling's series, plenty accurate past the table
+    double x ((double) k);
+    return (x + 0.5) * std::log(x) - x + 0.9189385332046728 + (1 / x) * (1 / 12.0 - 1 / (360.0 * x * x));
+}
+
+//number of "good" items in a sample of size sample drawn without replacement from good + bad items
+std::int64_t drawHypergeometric(std::int64_t good, std::int64_t bad, std::int64_t sample, RandomStream& rng) {
+    std::int64_t total (good + bad);
+    if (sample <= 0 || good <= 0) {
+        return 0;
+    }
+    if (bad <= 0) {
+        return sample;
+    }
+    if (sample >= total) {
+        return good;
+    }
+
+    //work with the smaller of the sample and its complement, and of good and bad
+    std::int64_t smallSample (std::min(sample, total - sample));
+    std::int64_t minGoodBad (std::min(good, bad));
+    std::int64_t maxGoodBad (std::max(good, bad));
+    std::int64_t k (0);
+
+    if (smallSample < 10) {
+        std::int64_t remaining (total);
+        std::int64_t remainingMin (minGoodBad);
+        for (std::int64_t i (0); i < smallSample && remainingMin > 0; ++i) {
+            if ((std::int64_t) (((double) rng() * 0x1p-32) * (double) remaining) < remainingMin) {
+                --remainingMin;
+                ++k;
+            }
+            --remaining;
+        }
+    }
+    else {
+        const double D1 (1.7155277699214135); //2 sqrt(2/e)
+        const double D2 (0.8989161620588988); //3 - 2 sqrt(3/e)
+        double p ((double) minGoodBad / (double) total);
+        double q ((double) maxGoodBad / (double) total);
+        double a ((double) smallSample * p + 0.5);
+        double variance ((double) (total - smallSample) * (double) smallSample * p * q / (double) (total - 1));
+        double c (std::sqrt(variance + 0.5));
+        double h (D1 * c + D2);
+        std::int64_t mode ((std::int64_t) std::floor((double) (smallSample + 1) * (double) (minGoodBad + 1) / (double) (total + 2)));
+        double g (logFactorial(mode) + logFactorial(minGoodBad - mode) + logFactorial(smallSample - mode)
+                  + logFactorial(maxGoodBad - smallSample + mode));
+        double bound (std::min((double) std::min(smallSample, minGoodBad) + 1, std::floor(a + 16 * c)));
+
+        while (true) {
+            double u ((rng() + 0.5) * 0x1p-32); //(0, 1), we divide by it
+            double v (rng() * 0x1p-32);
+            double x (a + h * (v - 0.5) / u);
+            if (x < 0 || x >= bound) {
+                continue;
+            }
+            k = (std::int64_t) std::floor(x);
+            double t (g - (logFactorial(k) + logFactorial(minGoodBad - k) + logFactorial(smallSample - k)
+                           + logFactorial(maxGoodBad - smallSample + k)));
+            if (u * (4.0 - u) - 3.0 <= t) {
+                break; //quick accept
+            }
+            if (u * (u - t) >= 1) {
+                continue; //quick reject
+            }
+            if (2.0 * std::log(u) <= t) {
+                break;
+            }
+        }
+    }
+
+    //undo the symmetries
+    if (good > bad) {
+        k = smallSample - k;
+    }
+    if (smallSample < sample) {
+        k = good - k;
+    }
+    return k;
+}
+
 /*
 Define the structure of an agent
 */
 
 class Agent {
 public:
-    char trait; //possible values are 'c' cooperate and 'd' defect
+    Trait trait; //strategy code, DEFECT or COOPERATE (or a game's extra strategies)
     float payoff;
     /*
     Constructor function
     */
-    Agent(char t, float p) {
+    Agent(Trait t, float p) {
         trait = t;
         payoff = p;
     }
 
     Agent() {
-        trait = 'd';
+        trait = DEFECT;
         payoff = 0;
     }
 
-    void setTrait(char newTrait) {
+    void setTrait(Trait newTrait) {
         trait = newTrait;
     }
 
-    char getTrait() const{
+    Trait getTrait() const{
         return trait;
     }
 
@@ -67,521 +519,5261 @@ public:
 };
 
 /*
-I guess we make another object for the 'group' level.
-What is the most efficient way to structure it?
-e.g. what data structure do we use to store the members?
-Also, for interactions are we using methods or 'general' functions?
-(not a CS student, correct me if I'm using the wrong terminology)
+Vector kernels for the element-wise steps that run once per agent per generation: the payoff lookup for the
+random pool's pairs, the tax transfer, and the sums behind totalPayoff and proportionCooperative. Each has a
+scalar version and an AVX2 version; which one runs is decided once at start-up from what the CPU supports
+(or forced with --kernels scalar). The scalar float sums keep eight running lanes and combine them in the same
+order the AVX2 ones do, so both give bit-identical results and a run doesn't depend on the machine.
 */
 
-class Group {
-public:
-    float proportionCooperative; //need to track this for when groups win conflicts
-    float taxRate; //Proportion of an agent's payoff which is redistributed to the group
-    float segmentationRate; //Chance an agent is matched with their own type. Gives some spatial structure
-    float totalPayoff; // total (not average!) payoff of agents in the group
-    size_t groupSize;
-    std::vector<Agent> agents;
+/*
+Payoffs of a random-pool pair, indexed by its pair code STRATEGIES * (first's strategy) + (second's strategy).
+Two-strategy games fit the 4 codes in one vector of 8, up to four strategies fit in two.
+*/
+const int MAX_PAIR_CODES = 256;
 
-    //Group(float pCoop = 0, float tRate = 0, float sRate = 0, float tPayoff = 0, std::vector<Agent> a)
-    Group(float pCoop, float tRate, float sRate, float tPayoff, size_t gSize) {
-      proportionCooperative = pCoop;
-      taxRate = tRate;
-      segmentationRate = sRate;
-      totalPayoff = tPayoff;
-      groupSize = gSize;
-      initAgents(groupSize);
-    }
+struct PairPayoffTable {
+    alignas(32) float first[MAX_PAIR_CODES];
+    alignas(32) float second[MAX_PAIR_CODES];
+    alignas(32) float tax[MAX_PAIR_CODES];
+};
 
-    Group() {
-        proportionCooperative = 0;
-        taxRate = 0;
-        segmentationRate = 0;
-        totalPayoff = 0;
-        groupSize = 0;
-        } //I thought it might be a good idea to move agent initialization to a method within the Group class, but let me know if there's a problem with this
+struct VectorKernels {
+    const char* name;
+    //writes both members' payoffs for every pair and returns the tax the pairs pay in; codes below 8
+    float (*pairPayoffs)(const std::uint8_t* codes, size_t numPairs, const PairPayoffTable& table, float* firstOut, float* secondOut);
+    //the same for codes below 16
+    float (*widePairPayoffs)(const std::uint8_t* codes, size_t numPairs, const PairPayoffTable& table, float* firstOut, float* secondOut);
+    void (*addToAll)(float* values, size_t n, float amount);
+    float (*sum)(const float* values, size_t n);
+    size_t (*popcount)(const std::uint64_t* words, size_t numWords);
+};
 
-    void initAgents(size_t numAgents) {
-        //get the number of agents who are cooperative based on groupSize and propCoop
-        int numCooperative = groupSize * (int) proportionCooperative;
+float combineLanes(const float lanes[8]) {
+    return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
 
-        std::vector<Agent> agentsTemp;
-        for (int i = 0; i < numAgents; ++i) {
-            if (i <= numCooperative) {
-                Agent agent ('c', 0);
-                agentsTemp.push_back(agent);
-            }
-            else {
-                Agent agent ('d', 0);
-                agentsTemp.push_back(agent);
-            }
+float scalarPairPayoffs(const std::uint8_t* codes, size_t numPairs, const PairPayoffTable& table, float* firstOut, float* secondOut) {
+    float lanes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    size_t k (0);
+    for (; k + 8 <= numPairs; k += 8) {
+        for (size_t l (0); l < 8; ++l) {
+            std::uint8_t code (codes[k + l]);
+            firstOut[k + l] = table.first[code];
+            secondOut[k + l] = table.second[code];
+            lanes[l] += table.tax[code];
         }
-        agents = agentsTemp;
     }
-
-    size_t getSize() {
-        return groupSize;
+    float tax (combineLanes(lanes));
+    for (; k < numPairs; ++k) {
+        firstOut[k] = table.first[codes[k]];
+        secondOut[k] = table.second[codes[k]];
+        tax += table.tax[codes[k]];
     }
+    return tax;
+}
 
-    /*
-    This method updates the two variables which are functions of the group data, rather than things we define;
-    namely, it computes the total payoff and then updates the proportion of the group which is cooperative.
-    */
-
-    void updateGroupData() {
-        size_t length (agents.size());
-        float dummyPayoff (0);
-        float dummyCoop (0);
+void scalarAddToAll(float* values, size_t n, float amount) {
+    for (size_t i (0); i < n; ++i) {
+        values[i] += amount;
+    }
+}
 
-        float cost (0.5 * (segmentationRate * segmentationRate + taxRate * taxRate)); //institutions are costly, see algorithm description
-        /*
-        this^^ is the reason it is important that in the Prisoners dilemma 2R > T + S, otherwise groups
-        which are more defective will have higher payoffs. You can think of this as defecting and agreeing to split
-        the higher reward T + S instead of splitting 2R. See e.g. Hofbauer and Sigmund for more info.
-        */
+float scalarSum(const float* values, size_t n) {
+    float lanes[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    size_t i (0);
+    for (; i + 8 <= n; i += 8) {
+        for (size_t l (0); l < 8; ++l) {
+            lanes[l] += values[i + l];
+        }
+    }
+    float total (combineLanes(lanes));
+    for (; i < n; ++i) {
+        total += values[i];
+    }
+    return total;
+}
 
-        for (size_t i = 0; i < length; ++i) {
-            dummyPayoff += (agents[i].getPayoff() - cost);
+size_t scalarPopcount(const std::uint64_t* words, size_t numWords) {
+    size_t total (0);
+    for (size_t w (0); w < numWords; ++w) {
+        total += std::popcount(words[w]);
+    }
+    return total;
+}
 
-            if (agents[i].getTrait() == 'c') { //is there a more efficient way to do this? I don't know
-                dummyCoop += 1;
-            }
-        }
+//the scalar lookup handles any code, so it does for both
+const VectorKernels SCALAR_KERNELS = {"scalar", scalarPairPayoffs, scalarPairPayoffs, scalarAddToAll, scalarSum, scalarPopcount};
 
-        dummyCoop /= (float)length; //uh I think this is fine
+#if EVOSIM_HAVE_AVX2
 
-        proportionCooperative = dummyCoop;
-        totalPayoff = dummyPayoff;
-        groupSize = agents.size();
+__attribute__((target("avx2")))
+float avx2PairPayoffs(const std::uint8_t* codes, size_t numPairs, const PairPayoffTable& table, float* firstOut, float* secondOut) {
+    __m256 firstTable = _mm256_load_ps(table.first);
+    __m256 secondTable = _mm256_load_ps(table.second);
+    __m256 taxTable = _mm256_load_ps(table.tax);
+    __m256 taxLanes = _mm256_setzero_ps();
+    size_t k (0);
+    for (; k + 8 <= numPairs; k += 8) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (codes + k)));
+        _mm256_storeu_ps(firstOut + k, _mm256_permutevar8x32_ps(firstTable, index));
+        _mm256_storeu_ps(secondOut + k, _mm256_permutevar8x32_ps(secondTable, index));
+        taxLanes = _mm256_add_ps(taxLanes, _mm256_permutevar8x32_ps(taxTable, index));
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, taxLanes);
+    float tax (combineLanes(lanes));
+    for (; k < numPairs; ++k) {
+        firstOut[k] = table.first[codes[k]];
+        secondOut[k] = table.second[codes[k]];
+        tax += table.tax[codes[k]];
     }
+    return tax;
+}
 
-    float getTotalPayoff() {
-        return totalPayoff;
+//two tables of 8, picked between by bit 3 of the code
+__attribute__((target("avx2")))
+float avx2WidePairPayoffs(const std::uint8_t* codes, size_t numPairs, const PairPayoffTable& table, float* firstOut, float* secondOut) {
+    __m256 firstLow = _mm256_load_ps(table.first), firstHigh = _mm256_load_ps(table.first + 8);
+    __m256 secondLow = _mm256_load_ps(table.second), secondHigh = _mm256_load_ps(table.second + 8);
+    __m256 taxLow = _mm256_load_ps(table.tax), taxHigh = _mm256_load_ps(table.tax + 8);
+    const __m256i seven = _mm256_set1_epi32(7);
+    __m256 taxLanes = _mm256_setzero_ps();
+    size_t k (0);
+    for (; k + 8 <= numPairs; k += 8) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) (codes + k)));
+        __m256 high = _mm256_castsi256_ps(_mm256_cmpgt_epi32(index, seven));
+        _mm256_storeu_ps(firstOut + k, _mm256_blendv_ps(_mm256_permutevar8x32_ps(firstLow, index),
+                                                         _mm256_permutevar8x32_ps(firstHigh, index), high));
+        _mm256_storeu_ps(secondOut + k, _mm256_blendv_ps(_mm256_permutevar8x32_ps(secondLow, index),
+                                                          _mm256_permutevar8x32_ps(secondHigh, index), high));
+        taxLanes = _mm256_add_ps(taxLanes, _mm256_blendv_ps(_mm256_permutevar8x32_ps(taxLow, index),
+                                                            _mm256_permutevar8x32_ps(taxHigh, index), high));
     }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, taxLanes);
+    float tax (combineLanes(lanes));
+    for (; k < numPairs; ++k) {
+        firstOut[k] = table.first[codes[k]];
+        secondOut[k] = table.second[codes[k]];
+        tax += table.tax[codes[k]];
+    }
+    return tax;
+}
 
-    float getPropCoop(){
-        return proportionCooperative;
+__attribute__((target("avx2")))
+void avx2AddToAll(float* values, size_t n, float amount) {
+    __m256 broadcast = _mm256_set1_ps(amount);
+    size_t i (0);
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(values + i, _mm256_add_ps(_mm256_loadu_ps(values + i), broadcast));
+    }
+    for (; i < n; ++i) {
+        values[i] += amount;
     }
+}
 
-    float getTaxRate(){
-        return taxRate;
+__attribute__((target("avx2")))
+float avx2Sum(const float* values, size_t n) {
+    __m256 lanes8 = _mm256_setzero_ps();
+    size_t i (0);
+    for (; i + 8 <= n; i += 8) {
+        lanes8 = _mm256_add_ps(lanes8, _mm256_loadu_ps(values + i));
     }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, lanes8);
+    float total (combineLanes(lanes));
+    for (; i < n; ++i) {
+        total += values[i];
+    }
+    return total;
+}
 
-    float getSegRate(){
-        return segmentationRate;
+//nibble lookup popcount (Mula): AVX2 has no vector popcount instruction
+__attribute__((target("avx2")))
+size_t avx2Popcount(const std::uint64_t* words, size_t numWords) {
+    const __m256i nibbleCounts = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                  0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+    __m256i totals = _mm256_setzero_si256();
+    size_t w (0);
+    for (; w + 4 <= numWords; w += 4) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (words + w));
+        __m256i low = _mm256_shuffle_epi8(nibbleCounts, _mm256_and_si256(v, lowNibble));
+        __m256i high = _mm256_shuffle_epi8(nibbleCounts, _mm256_and_si256(_mm256_srli_epi16(v, 4), lowNibble));
+        totals = _mm256_add_epi64(totals, _mm256_sad_epu8(_mm256_add_epi8(low, high), _mm256_setzero_si256()));
+    }
+    alignas(32) std::uint64_t lanes[4];
+    _mm256_store_si256((__m256i*) lanes, totals);
+    size_t total (lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+    for (; w < numWords; ++w) {
+        total += std::popcount(words[w]);
     }
+    return total;
+}
 
-    void setInstitutions(float tR, float sR) {
-        taxRate = tR;
-        segmentationRate = sR;
+const VectorKernels AVX2_KERNELS = {"avx2", avx2PairPayoffs, avx2WidePairPayoffs, avx2AddToAll, avx2Sum, avx2Popcount};
+
+#endif
+
+const VectorKernels* chooseKernels() {
+#if EVOSIM_HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        return &AVX2_KERNELS;
     }
+#endif
+    return &SCALAR_KERNELS;
+}
 
-    void addAgent(Agent a) {
-        agents.push_back(a);
-        groupSize++;
+const VectorKernels* activeKernels = chooseKernels();
+
+/*
+Population store for a group. Rather than a vector of Agent objects (a char and a float, padded out to 8 bytes)
+we keep the strategy codes packed TRAIT_BITS to an agent (so one bit, 1 = cooperator, in the prisoner's
+dilemma) and the payoffs in their own contiguous float array. Reading a population never copies it: use the
+span accessors or the per-index getters. Fields past size() are always kept at zero so that counting a
+strategy is just a pass of popcounts over the words.
+*/
+
+template <typename Game>
+class Population {
+public:
+    static constexpr int BITS = TRAIT_BITS<Game>;
+    static constexpr size_t PER_WORD = 64 / BITS;
+    static constexpr std::uint64_t FIELD = (std::uint64_t(1) << BITS) - 1;
+
+    Population() {
+        count = 0;
     }
 
-    //this is giving some kind of strange error
-    /*
-    void removeAgent(Agent a) {
-        agents.erase(find(agents.begin(), agents.end(), a));
-        groupSize--;
-        // TODO: add agent vector init here
+    //trait words needed for n agents
+    static size_t wordsFor(size_t n) {
+        return (n + PER_WORD - 1) / PER_WORD;
     }
-    */
 
-    void updatePayoffByIndex(size_t index, float newPayoff) {
-        agents[index].setPayoff(newPayoff);
+    size_t size() const {
+        return count;
     }
 
-    void transferByIndex(size_t index, float transferAmount) {
-        agents[index].setPayoff(agents[index].getPayoff() + transferAmount);
+    bool empty() const {
+        return count == 0;
     }
 
-    void updateTraitByIndex(size_t index, char newTrait) {
-        agents[index].setTrait(newTrait);
+    Trait getTrait(size_t index) const {
+        return (Trait) ((traitBits[index / PER_WORD] >> (index % PER_WORD * BITS)) & FIELD);
     }
 
-    std::vector<Agent> getAgents() {
-        return agents;
+    bool isCooperator(size_t index) const {
+        return Game::COOPERATES[getTrait(index)];
     }
 
-    void overhaulAgents(std::vector<Agent> newAgents) {
-        agents = newAgents;
+    void setTrait(size_t index, Trait newTrait) {
+        unsigned shift (index % PER_WORD * BITS);
+        std::uint64_t& word = traitBits[index / PER_WORD];
+        word = (word & ~(FIELD << shift)) | ((std::uint64_t) newTrait << shift);
     }
-};
 
+    float getPayoff(size_t index) const {
+        return payoff[index];
+    }
 
-void playWithinGroup(Group& group) {
-    /*
-    Defining these values so we can use them later. I chose smallish values because some of the transition
-    probabilities Bowles describes look small and I want to make sure payoffs don't overwhelm mutations.
-    */
-    float suckersPayoff = 0; //S
-    float temptationToDefect = 1; //T
-    float rewardForCooperation = 0.6; //R
-    float mutualPunishment = 0.3; //P
-    float taxPool = 0;
-    float T = group.getTaxRate();
+    void setPayoff(size_t index, float newPayoff) {
+        payoff[index] = newPayoff;
+    }
 
-    /*
-    Randomness in pairings. Create three pools, then randomize the third pool and play the game within
-    groups
-    */
-    auto seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    std::mt19937 randomizer; //for good (pseudo) randomness
-    randomizer.seed((unsigned long)seed);
-    std::uniform_real_distribution<> dis(0.0, 1.0); //uniform distribution on [0, 1]
-    std::vector<size_t> cooperators; //the indices corresponding to cooperators who are paired
-    std::vector<size_t> defectors;
-    std::vector<size_t> randomPool;
+    void addPayoff(size_t index, float amount) {
+        payoff[index] += amount;
+    }
 
-    size_t length (group.getAgents().size());
+    void clearPayoffs() {
+        std::fill(payoff.begin(), payoff.end(), 0.0f);
+    }
 
-    //first pooling according to the segmentation rate
-    for (size_t j (0); j < length; ++j) {
-        //compare uniform random number between 0 and 1 against segmentation rate.
-        float randResult = dis(randomizer);
-        if (randResult <= group.getSegRate() && group.getAgents()[j].getTrait() == 'c') {
-            cooperators.push_back(j);
-        } //cooperators get paired with probability = segmentation rate
-        else if (randResult <= group.getSegRate() && group.getAgents()[j].getTrait() == 'd') {
-            defectors.push_back(j);
-        } //defectors get paired with probability = segmentation rate
-        else {
-            randomPool.push_back(j);
-        } //pair those who weren't segmented into a group that itself gets randomized
+    void push_back(Trait trait, float p) {
+        reserve(count + 1);
+        if (count % PER_WORD == 0) {
+            traitBits.push_back(0);
+        }
+        payoff.push_back(p);
+        ++count;
+        setTrait(count - 1, trait);
     }
-    //now shuffle the randomPool by randomly permuting the elements
-    std::shuffle(randomPool.begin(), randomPool.end(), randomizer);
 
-    //now play the game for every collection of indices
+    //appends copies of agents [first, last) of another population
+    void append(const Population& other, size_t first, size_t last) {
+        reserve(count + (last - first));
+        for (size_t i (first); i < last; ++i) {
+            push_back(other.getTrait(i), other.getPayoff(i));
+        }
+    }
 
-    for (size_t k (0); k < cooperators.size(); ++k) {
-        group.updatePayoffByIndex(cooperators[k], (1 - T) * rewardForCooperation); //1 - T removes taxes
-        taxPool += 2 * T * rewardForCooperation;
+    //appends n identical agents, used when the winner of a conflict repopulates the loser
+    void appendCopies(Trait trait, float p, size_t n) {
+        reserve(count + n);
+        for (size_t i (0); i < n; ++i) {
+            push_back(trait, p);
+        }
     }
 
-    for (size_t l (0); l < defectors.size(); ++l) {
-        group.updatePayoffByIndex(defectors[l], (1 - T) * mutualPunishment);
-        taxPool += 2 * T * mutualPunishment;
+    //replaces the members with n agents read straight from packed trait words and a payoff array
+    void assign(const std::uint64_t* words, const float* payoffs, size_t n) {
+        clear();
+        reserve(n);
+        traitBits.assign(words, words + wordsFor(n));
+        payoff.assign(payoffs, payoffs + n);
+        count = n;
     }
 
-    int rpLength (randomPool.size());
+    //drops everyone from index n on
+    void truncate(size_t n) {
+        if (n >= count) {
+            return;
+        }
+        count = n;
+        payoff.resize(n);
+        traitBits.resize(wordsFor(n));
+        if (n % PER_WORD != 0) {
+            traitBits.back() &= (std::uint64_t(1) << (n % PER_WORD * BITS)) - 1; //keep the fields past size() clear
+        }
+    }
 
-    //check if rpLength is odd
-    if (rpLength % 2 != 0) {
-        randomPool.pop_back();
-        --rpLength; //make sure to actually reflect the fact that we changed the length of the random pool
+    //capacity goes up in powers of two: buffers get passed between groups of different sizes, and this way
+    //they settle on a handful of sizes after a few generations instead of creeping up one agent at a time
+    void reserve(size_t n) {
+        if (n > payoff.capacity()) {
+            size_t rounded (std::bit_ceil(std::max<size_t>(n, 64)));
+            traitBits.reserve(rounded / PER_WORD);
+            payoff.reserve(rounded);
+        }
     }
 
-    if (rpLength > 0) {
+    void clear() {
+        traitBits.clear();
+        payoff.clear();
+        count = 0;
+    }
 
-        for (size_t m (0); m < rpLength - 1; m+=2) {
+    void swap(Population& other) {
+        traitBits.swap(other.traitBits);
+        payoff.swap(other.payoff);
+        std::swap(count, other.count);
+    }
 
-            if (group.getAgents()[m].getTrait() == 'c' && group.getAgents()[m+1].getTrait() == 'c') {
-                group.updatePayoffByIndex(m, rewardForCooperation);
-                group.updatePayoffByIndex(m+1, rewardForCooperation); //case 1, both cooperate
-                taxPool += 2 * T * (rewardForCooperation);
-            }
-            else if (group.getAgents()[m].getTrait() == 'c' && group.getAgents()[m+1].getTrait() == 'd') {
-                group.updatePayoffByIndex(m, suckersPayoff);
-                group.updatePayoffByIndex(m+1, temptationToDefect); //case 2, p1 coop p2 defect
-                taxPool += T * (suckersPayoff + temptationToDefect);
-            }
-            else if (group.getAgents()[m].getTrait() == 'd' && group.getAgents()[m+1].getTrait() == 'd') {
-                group.updatePayoffByIndex(m, mutualPunishment);
-                group.updatePayoffByIndex(m+1, mutualPunishment); //case 3, both defect
-                taxPool += 2 * T * (mutualPunishment);
+    //how many agents play the given strategy
+    size_t countStrategy(Trait code) const {
+        if constexpr (BITS == 1) {
+            size_t ones (activeKernels->popcount(traitBits.data(), traitBits.size()));
+            return code == 1 ? ones : count - ones;
+        }
+        else {
+            //xor with the code in every field leaves the matching fields zero; fold each field onto its lowest bit
+            constexpr std::uint64_t lowBits = ~std::uint64_t(0) / FIELD;
+            std::uint64_t pattern (lowBits * code);
+            size_t different (0);
+            for (std::uint64_t word : traitBits) {
+                std::uint64_t x (word ^ pattern);
+                for (int shift (1); shift < BITS; shift *= 2) {
+                    x |= x >> shift;
+                }
+                different += std::popcount(x & lowBits);
             }
-            else {
-                group.updatePayoffByIndex(m, temptationToDefect);
-                group.updatePayoffByIndex(m+1, suckersPayoff); //reverse of case 2
-                taxPool += T * (suckersPayoff + temptationToDefect);
+            //the padding fields past size() are zero, and matched if the code is
+            size_t fields (traitBits.size() * PER_WORD);
+            return fields - different - (code == 0 ? fields - count : 0);
+        }
+    }
+
+    size_t countCooperators() const {
+        size_t total (0);
+        for (int code (0); code < Game::STRATEGIES; ++code) {
+            if (Game::COOPERATES[code]) {
+                total += countStrategy((Trait) code);
             }
         }
+        return total;
     }
 
-    float transfer = taxPool / (float) group.getAgents().size();
+    std::span<const float> payoffs() const {
+        return std::span<const float>(payoff.data(), count);
+    }
 
-    for (size_t n (0); n < length; ++n) {
-        group.transferByIndex(n, transfer); //add transfer amount to everyone in the group's payoff
+    std::span<float> payoffs() {
+        return std::span<float>(payoff.data(), count);
     }
-}
+
+    std::span<const std::uint64_t> traitWords() const {
+        return std::span<const std::uint64_t>(traitBits.data(), traitBits.size());
+    }
+
+private:
+    std::vector<std::uint64_t> traitBits;
+    std::vector<float> payoff;
+    size_t count;
+};
 
 /*
-Step 3b and 3c of the algorithm
+I guess we make another object for the 'group' level.
+The members live in a Population (see above), which hands out read-only views instead of copies. Groups are
+templates on the game like their populations; Group is the prisoner's dilemma one.
 */
-void haveChildren(Group& group) {
-    auto seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    std::mt19937 randomizer;
-    randomizer.seed((unsigned long)seed);
-    std::uniform_real_distribution<> dis(0.0, 1.0);
-    float total = group.getTotalPayoff();
 
-    size_t groupSize = group.getSize();
-    std::vector<int> subintervals;
-    std::vector<float> weights;
+template <typename Game>
+class BasicGroup {
+public:
+    using GameType = Game;
+
+    float proportionCooperative; //need to track this for when groups win conflicts
+    float taxRate; //Proportion of an agent's payoff which is redistributed to the group
+    float segmentationRate; //Chance an agent is matched with their own type. Gives some spatial structure
+    float totalPayoff; // total (not average!) payoff of agents in the group
+    size_t groupSize;
+    std::uint32_t id = 0; //stays with the group when the world is shuffled, for output
+    size_t numCooperators = 0; //as of the last updateComposition
+    bool statsChanged = true; //raised by anything that moves the group's share of the world statistics, see WorldStatistics
+    Population<Game> agents;
+    Population<Game> nextAgents; //the other half of the double buffer: children are written here, then the two swap
+
+    BasicGroup(float pCoop, float tRate, float sRate, float tPayoff, size_t gSize) {
+      proportionCooperative = pCoop;
+      taxRate = tRate;
+      segmentationRate = sRate;
+      totalPayoff = tPayoff;
+      groupSize = gSize;
+      initAgents(groupSize);
+    }
+
+    BasicGroup() {
+        proportionCooperative = 0;
+        taxRate = 0;
+        segmentationRate = 0;
+        totalPayoff = 0;
+        groupSize = 0;
+        }
+
+    void initAgents(size_t numAgents) {
+        //get the number of agents who are cooperative based on groupSize and propCoop
+        size_t numCooperative = (size_t) ((float) numAgents * proportionCooperative);
+
+        agents.clear();
+        agents.appendCopies(COOPERATE, 0, numCooperative);
+        agents.appendCopies(DEFECT, 0, numAgents - numCooperative);
+        groupSize = agents.size();
+    }
+
+    size_t getSize() const {
+        return groupSize;
+    }
+
+    /*
+    This method updates the two variables which are functions of the group data, rather than things we define;
+    namely, it computes the total payoff and then updates the proportion of the group which is cooperative.
+    */
+
+    void updateGroupData() {
+        std::span<const float> payoffs = agents.payoffs();
+
+        float cost (0.5 * (segmentationRate * segmentationRate + taxRate * taxRate)); //institutions are costly, see algorithm description
+        /*
+        this^^ is the reason it is important that in the Prisoners dilemma 2R > T + S, otherwise groups
+        which are more defective will have higher payoffs. You can think of this as defecting and agreeing to split
+        the higher reward T + S instead of splitting 2R. See e.g. Hofbauer and Sigmund for more info.
+        */
 
-    for (size_t i = 0; i <= groupSize; ++i) {
-        subintervals.push_back(i);
+        totalPayoff = activeKernels->sum(payoffs.data(), payoffs.size()) - cost * (float) payoffs.size();
+        updateComposition();
     }
-    for (size_t j = 0; j < groupSize; ++j) {
-        float pj = group.getAgents()[j].getPayoff();
-        weights.push_back(pj / total);
+
+    /*
+    Just the cooperator share and size, for when the members change but nobody has played yet
+    (new children, or the shake-up after a conflict).
+    */
+    void updateComposition() {
+        groupSize = agents.size();
+        numCooperators = agents.countCooperators();
+        proportionCooperative = groupSize > 0 ? (float) numCooperators / (float) groupSize : 0;
+        statsChanged = true;
     }
 
-    //This defines a probability mass function on subintervals given by the indices of agents
-    std::piecewise_constant_distribution<> d(subintervals.begin(), subintervals.end(), weights.begin());
+    float getTotalPayoff() const {
+        return totalPayoff;
+    }
 
-    int sexHavers = 0;
+    float getPropCoop() const {
+        return proportionCooperative;
+    }
 
-    std::vector<Agent> childPool;
+    size_t getCooperators() const {
+        return numCooperators;
+    }
 
-    while (sexHavers < groupSize) {
-        float randResult = d(randomizer);
-        int randIndex = (int) randResult;
-        Agent agent = group.getAgents()[randIndex];
-        float mutation = dis(randomizer);
+    float getTaxRate() const {
+        return taxRate;
+    }
 
-        //individual mutation chance for every agent
-        if (mutation <= INDIVIDUAL_MUTATION_RATE && agent.getTrait() == 'c') {
-            agent.setTrait('d');
+    float getSegRate() const {
+        return segmentationRate;
+    }
+
+    void setInstitutions(float tR, float sR) {
+        taxRate = tR;
+        segmentationRate = sR;
+        statsChanged = true;
+    }
+
+    void addAgent(const Agent& a) {
+        agents.push_back(a.getTrait(), a.getPayoff());
+        groupSize++;
+    }
+
+    void updatePayoffByIndex(size_t index, float newPayoff) {
+        agents.setPayoff(index, newPayoff);
+    }
+
+    void transferByIndex(size_t index, float transferAmount) {
+        agents.addPayoff(index, transferAmount);
+    }
+
+    void updateTraitByIndex(size_t index, Trait newTrait) {
+        agents.setTrait(index, newTrait);
+    }
+
+    const Population<Game>& getAgents() const {
+        return agents;
+    }
+
+    //takes ownership of newAgents' storage; newAgents is left holding the old members
+    void overhaulAgents(Population<Game>& newAgents) {
+        agents.swap(newAgents);
+        groupSize = agents.size();
+    }
+};
+
+using Group = BasicGroup<PrisonersDilemma>; //the original model
+
+
+/*
+Per-thread scratch memory. The phases need a handful of temporary arrays per group (the random pool, pair
+codes, alias tables, ...), which used to be fresh vectors every time. Instead each thread has an Arena: a
+single block that temporaries are carved off the front of and handed back in one go when the ArenaScope that
+took them ends. If a generation asks for more than the block holds, the extra comes from the heap for now and
+the block is regrown to the high-water mark once everything has been handed back, so after the first few
+generations the block is big enough and nothing touches the heap.
+(Populations aren't arena memory: each group double-buffers its own, see Group::nextAgents.)
+*/
+
+class Arena {
+public:
+    template <typename T>
+    std::span<T> allocate(size_t n) {
+        static_assert(std::is_trivially_destructible_v<T>, "arena memory is never destroyed");
+        size_t bytes (n * sizeof(T));
+        size_t start ((used + alignof(T) - 1) / alignof(T) * alignof(T));
+        demand = std::max(demand, start + bytes);
+        T* memory;
+        if (start + bytes <= capacity) {
+            memory = reinterpret_cast<T*>(block.get() + start);
+            used = start + bytes;
+        }
+        else {
+            overflow.emplace_back(new std::byte[bytes + alignof(T)]);
+            std::byte* raw = overflow.back().get();
+            memory = reinterpret_cast<T*>(raw + (alignof(T) - (reinterpret_cast<std::uintptr_t>(raw) % alignof(T))) % alignof(T));
+            used = start + bytes; //keep counting so demand reflects the whole scope
         }
-        else if (mutation <= INDIVIDUAL_MUTATION_RATE && agent.getTrait() == 'd') {
-            agent.setTrait('c');
+        return std::span<T>(memory, n);
+    }
+
+    size_t mark() const {
+        return used;
+    }
+
+    void release(size_t toMark) {
+        used = toMark;
+        if (used == 0 && !overflow.empty()) {
+            overflow.clear();
+            capacity = demand + demand / 4;
+            block.reset(new std::byte[capacity]);
         }
+    }
+
+private:
+    std::unique_ptr<std::byte[]> block;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t demand = 0; //most a scope has ever asked for
+    std::vector<std::unique_ptr<std::byte[]>> overflow;
+};
 
-        childPool.push_back(agent);
+Arena& threadArena() {
+    thread_local Arena arena;
+    return arena;
+}
+
+//hands everything allocated while it was alive back to the arena
+class ArenaScope {
+public:
+    explicit ArenaScope(Arena& a) : arena(a), start(a.mark()) {}
 
-        ++sexHavers;
+    ~ArenaScope() {
+        arena.release(start);
     }
 
-    group.overhaulAgents(childPool);
-    group.updateGroupData();
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator= (const ArenaScope&) = delete;
+
+    template <typename T>
+    std::span<T> allocate(size_t n) {
+        return arena.allocate<T>(n);
+    }
+
+private:
+    Arena& arena;
+    size_t start;
+};
+
+template <typename Game>
+void playWithinGroup(BasicGroup<Game>& group, RandomStream& rng) {
+    constexpr int N = Game::STRATEGIES;
+    constexpr int PAIR_CODES = N * N;
+    static_assert(PAIR_CODES <= MAX_PAIR_CODES, "pair codes have to fit in a byte");
+    float taxPool = 0;
+    float T = group.getTaxRate();
+    float segRate = group.getSegRate();
 
-    std::uniform_int_distribution<> twoCoin(0, 3);
     /*
-    0 = increase tax rate, increase seg rate
-    1 = increase tax rate, decrease seg rate
-    2 = decrease tax rate, increase seg rate
-    3 = decrease tax rate, decrease seg rate
+    The whole payoff matrix as lookup tables, so nobody branches on traits. Segmented agents play their own
+    type and are indexed by their strategy code; random pairs by their pair code.
     */
-    int flips = twoCoin(randomizer);
-    float institutionalChange = dis(randomizer);
+    float segmentedPayoff[N];
+    float segmentedTax[N];
+    for (int c (0); c < N; ++c) {
+        segmentedPayoff[c] = (1 - T) * Game::PAYOFF[c][c]; //1 - T removes taxes
+        segmentedTax[c] = 2 * T * Game::PAYOFF[c][c];
+    }
+    PairPayoffTable table;
+    std::fill(table.first, table.first + 16, 0.0f); //the vector kernels load whole rows of 8
+    std::fill(table.second, table.second + 16, 0.0f);
+    std::fill(table.tax, table.tax + 16, 0.0f);
+    for (int a (0); a < N; ++a) {
+        for (int b (0); b < N; ++b) {
+            table.first[N * a + b] = Game::PAYOFF[a][b];
+            table.second[N * a + b] = Game::PAYOFF[b][a];
+            table.tax[N * a + b] = a == b ? 2 * T * Game::PAYOFF[a][a] : T * (Game::PAYOFF[a][b] + Game::PAYOFF[b][a]);
+        }
+    }
 
-    if (institutionalChange <= INSTITUTIONAL_CHANGE_CHANCE && flips == 0 && group.getTaxRate() <= 0.9 && group.getSegRate() <= 0.4) {//1 = heads, increase
-        group.setInstitutions(group.getTaxRate() + 0.1, group.getSegRate() + 0.1);
-    } else if (institutionalChange <= INSTITUTIONAL_CHANGE_CHANCE && flips == 1 && group.getSegRate() >= 0.1 && group.getTaxRate() <= 0.9) {
-        group.setInstitutions(group.getTaxRate() + 0.1, group.getSegRate() - 0.1);
-    } else if (institutionalChange <= INSTITUTIONAL_CHANGE_CHANCE && flips == 2  && group.getTaxRate() >= 0.1 && group.getSegRate() <= 0.4) {
-        group.setInstitutions(group.getTaxRate() - 0.1, group.getSegRate() + 0.1);
-    } else if (institutionalChange <= INSTITUTIONAL_CHANGE_CHANCE && flips == 3 && group.getSegRate() >= 0.1 && group.getTaxRate() >= 0.1) {
-        group.setInstitutions(group.getTaxRate() - 0.1, group.getSegRate() - 0.1);
+    ArenaScope scratch (threadArena());
+    Population<Game>& agents = group.agents;
+    size_t length (agents.size());
+    std::span<float> payoffs = agents.payoffs();
+
+    //payoffs are earned fresh every generation, so anyone left unpaired only gets the transfer
+    agents.clearPayoffs();
+
+    /*
+    Randomness in pairings. Agents are segmented (paired with their own type) with probability = segmentation
+    rate; everyone else goes into a random pool that gets shuffled and paired off
+    */
+    std::uint32_t* randomPool = scratch.allocate<std::uint32_t>(length).data();
+    size_t rpLength (0);
+    for (size_t j (0); j < length; ++j) {
+        float randResult = rng.uniform();
+        if (randResult <= segRate) {
+            Trait own (agents.getTrait(j));
+            payoffs[j] = segmentedPayoff[own];
+            taxPool += segmentedTax[own];
+        }
+        else {
+            randomPool[rpLength++] = (std::uint32_t) j;
+        }
+    }
+    //now shuffle the randomPool by randomly permuting the elements
+    shuffleRange(randomPool, rpLength, rng);
+
+    //an odd agent out doesn't get to play
+    size_t numPairs (rpLength / 2);
+    std::span<std::uint8_t> pairCodes = scratch.allocate<std::uint8_t>(numPairs);
+    std::span<float> firstPayoffs = scratch.allocate<float>(numPairs);
+    std::span<float> secondPayoffs = scratch.allocate<float>(numPairs);
+    for (size_t m (0); m < numPairs; ++m) {
+        pairCodes[m] = (std::uint8_t) (N * agents.getTrait(randomPool[2 * m]) + agents.getTrait(randomPool[2 * m + 1]));
+    }
+
+    //the widest table the vector kernels take is 16 codes; bigger games look up in plain C++
+    if constexpr (PAIR_CODES <= 8) {
+        taxPool += activeKernels->pairPayoffs(pairCodes.data(), numPairs, table, firstPayoffs.data(), secondPayoffs.data());
+    }
+    else if constexpr (PAIR_CODES <= 16) {
+        taxPool += activeKernels->widePairPayoffs(pairCodes.data(), numPairs, table, firstPayoffs.data(), secondPayoffs.data());
+    }
+    else {
+        taxPool += scalarPairPayoffs(pairCodes.data(), numPairs, table, firstPayoffs.data(), secondPayoffs.data());
+    }
+
+    for (size_t m (0); m < numPairs; ++m) {
+        payoffs[randomPool[2 * m]] = firstPayoffs[m];
+        payoffs[randomPool[2 * m + 1]] = secondPayoffs[m];
     }
 
+    float transfer = length > 0 ? taxPool / (float) length : 0;
+
+    activeKernels->addToAll(payoffs.data(), length, transfer); //add transfer amount to everyone in the group's payoff
 }
 
 /*
-Define how the game works for groups. Note that not every group participates in conflict, a group is drawn in
-with chance GROUP_CONFLICT_CHANCE (defined way above)
+Choosing parents. Each child picks its parent with probability proportional to payoff, which we do with a
+Walker/Vose alias table: O(n) to build and two draws per child, whatever the spread of payoffs.
+The tables are carved out of the thread's arena for the duration of the call.
 */
-void playGroupGame(Group& groupOne, Group& groupTwo) {
-    std::mt19937 randomizer;
-
-    float payoffOne (groupOne.getTotalPayoff());
-    float payoffTwo (groupTwo.getTotalPayoff());
-    std::vector<Agent> pool;
 
-    if (payoffOne >= payoffTwo) {//arbitrarily break ties in favor of group 1. randomize going forward?
-        groupTwo.setInstitutions(groupOne.getTaxRate(), groupOne.getSegRate()); //group 2 gets 1's institutions
+class AliasSampler {
+public:
+    //weights don't need normalizing; if nobody earned anything every parent is equally likely
+    AliasSampler(std::span<const float> weights, ArenaScope& scratch) {
+        size_t n (weights.size());
+        probability = scratch.allocate<float>(n);
+        alias = scratch.allocate<std::uint32_t>(n);
 
-        size_t numCoopTwo = (size_t) ((float) groupTwo.getSize() * groupOne.getPropCoop());
+        double total (0);
+        for (float w : weights) {
+            total += w > 0 ? w : 0;
+        }
+        if (!(total > 0) || !std::isfinite(total)) {
+            std::fill(probability.begin(), probability.end(), 1.0f);
+            std::iota(alias.begin(), alias.end(), 0u);
+            return;
+        }
 
-        //generate the enlarged pool to split between groups
-        for (size_t i(0); i < groupOne.getSize() + groupTwo.getSize(); ++i) {
-            if (i < groupOne.getSize()) {
-                pool.push_back(groupOne.getAgents()[i]);
-            }
-            else if (i >= groupOne.getSize() && i < groupOne.getSize() + numCoopTwo) {
-                Agent agent ('c', 0);
-                pool.push_back(agent);
+        std::span<double> scaled = scratch.allocate<double>(n);
+        std::span<std::uint32_t> small = scratch.allocate<std::uint32_t>(n);
+        std::span<std::uint32_t> large = scratch.allocate<std::uint32_t>(n);
+        size_t numSmall (0);
+        size_t numLarge (0);
+        for (size_t i (0); i < n; ++i) {
+            scaled[i] = (weights[i] > 0 ? weights[i] : 0) * (double) n / total;
+            if (scaled[i] < 1.0) {
+                small[numSmall++] = (std::uint32_t) i;
             }
             else {
-                Agent agent ('d', 0);
-                pool.push_back(agent);
+                large[numLarge++] = (std::uint32_t) i;
             }
         }
 
-    int poolSize (pool.size());
-    std::uniform_int_distribution<> uniZ(4, poolSize - 4);
+        //pair every under-full column with an over-full one that tops it up
+        while (numSmall > 0 && numLarge > 0) {
+            std::uint32_t less (small[--numSmall]);
+            std::uint32_t more (large[numLarge - 1]);
+            probability[less] = (float) scaled[less];
+            alias[less] = more;
+            scaled[more] -= (1.0 - scaled[less]);
+            if (scaled[more] < 1.0) {
+                --numLarge;
+                small[numSmall++] = more;
+            }
+        }
+        //whatever is left is full up to rounding error
+        for (size_t i (0); i < numLarge; ++i) {
+            probability[large[i]] = 1.0f;
+            alias[large[i]] = large[i];
+        }
+        for (size_t i (0); i < numSmall; ++i) {
+            probability[small[i]] = 1.0f;
+            alias[small[i]] = small[i];
+        }
+    }
 
-    int sizeTwo = uniZ(randomizer); //pick a random index to split groups 1 and 2
+    size_t sample(RandomStream& rng) const {
+        std::uint32_t column (rng.below((std::uint32_t) probability.size()));
+        return rng.uniform() < probability[column] ? column : alias[column];
+    }
 
-    //split groups randomly, I think
-    groupOne.overhaulAgents(std::vector<Agent>(pool.begin(), pool.end() - sizeTwo));
-    groupTwo.overhaulAgents(std::vector<Agent>(pool.end() - sizeTwo, pool.end()));
+private:
+    std::span<float> probability;
+    std::span<std::uint32_t> alias;
+};
 
-    groupOne.updateGroupData();
-    groupTwo.updateGroupData();
+/*
+Alias draws one parent per child. With only a few strategies that is more than we need: a child plays strategy
+k with probability q_k = s_k(1 - mu) + (1 - s_k)mu/(STRATEGIES - 1), where s_k is strategy k's share of the
+payoff, independently of the others, so Binomial draws the count of each strategy in one go (a chain of
+binomials, i.e. a multinomial, with more than two) and scatters them in random order (the order matters when a
+conflict splits the group). Both give the same distribution of children.
+*/
+enum class ReproductionMode {
+    Alias,
+    Binomial
+};
 
-    } //group one wins
+//a mutant switches to one of the other strategies, all equally likely
+template <typename Game>
+Trait mutate(Trait trait, RandomStream& rng) {
+    if constexpr (Game::STRATEGIES == 2) {
+        return trait ^ 1;
+    }
     else {
-        groupOne.setInstitutions(groupTwo.getTaxRate(), groupOne.getTaxRate());
+        return (Trait) ((trait + 1 + rng.below(Game::STRATEGIES - 1)) % Game::STRATEGIES);
+    }
+}
 
-        size_t numCoopOne = (size_t) ((float) groupOne.getSize() * groupTwo.getPropCoop());
+template <typename Game>
+void drawChildrenAlias(const Population<Game>& parents, Population<Game>& children, float mutationRate, RandomStream& rng) {
+    ArenaScope scratch (threadArena());
+    AliasSampler sampler (parents.payoffs(), scratch);
 
-        //generate the enlarged pool to split between groups
-        for (size_t i(0); i < groupOne.getSize() + groupTwo.getSize(); ++i) {
-            if (i < groupTwo.getSize()) {
-                pool.push_back(groupTwo.getAgents()[i]);
-            }
-            else if (i >= groupTwo.getSize() && i < groupOne.getSize() + numCoopOne) {
-                Agent agent ('c', 0);
-                pool.push_back(agent);
-            }
-            else {
-                Agent agent ('d', 0);
-                pool.push_back(agent);
-            }
+    for (size_t sexHavers (0); sexHavers < parents.size(); ++sexHavers) {
+        Trait trait = parents.getTrait(sampler.sample(rng));
+        float mutation = rng.uniform();
+
+        //individual mutation chance for every agent
+        if (mutation <= mutationRate) {
+            trait = mutate<Game>(trait, rng);
         }
 
-        int poolSize (pool.size());
-        std::uniform_int_distribution<> uniZ(4, poolSize - 4);
+        children.push_back(trait, 0); //children haven't played yet
+    }
+}
+
+template <typename Game>
+void drawChildrenBinomial(const Population<Game>& parents, Population<Game>& children, float mutationRate, RandomStream& rng) {
+    constexpr int N = Game::STRATEGIES;
+    size_t groupSize (parents.size());
+    double strategyPayoff[N] = {};
+    double allPayoff (0);
+    for (size_t i (0); i < groupSize; ++i) {
+        float p (std::max(parents.getPayoff(i), 0.0f));
+        allPayoff += p;
+        strategyPayoff[parents.getTrait(i)] += p;
+    }
 
-        int sizeOne = uniZ(randomizer); //pick a random index to split groups 1 and 2
+    //strategies from the highest code down, so in the prisoner's dilemma this is one binomial for the cooperators
+    size_t left[N];
+    std::int64_t trialsLeft ((std::int64_t) groupSize);
+    double massLeft (1);
+    for (int c (N - 1); c > 0; --c) {
+        double share = allPayoff > 0 ? strategyPayoff[c] / allPayoff : (double) parents.countStrategy((Trait) c) / (double) groupSize;
+        double q = share * (1 - mutationRate) + (1 - share) * (mutationRate / (N - 1));
+        std::binomial_distribution<std::int64_t> draw (trialsLeft, std::clamp(q / massLeft, 0.0, 1.0));
+        left[c] = (size_t) draw(rng);
+        trialsLeft -= (std::int64_t) left[c];
+        massLeft -= q;
+    }
+    left[0] = (size_t) trialsLeft;
 
-        //split groups randomly, I think
-        groupTwo.overhaulAgents(std::vector<Agent>(pool.begin(), pool.end() - sizeOne));
-        groupOne.overhaulAgents(std::vector<Agent>(pool.end() - sizeOne, pool.end()));
-        groupOne.updateGroupData();
-        groupTwo.updateGroupData();
-    } //group two wins
+    //selection sampling: every arrangement of the strategies is equally likely
+    for (size_t i (0); i < groupSize; ++i) {
+        size_t pick (rng.below((std::uint32_t) (groupSize - i)));
+        int c (N - 1);
+        while (pick >= left[c]) {
+            pick -= left[c];
+            --c;
+        }
+        --left[c];
+        children.push_back((Trait) c, 0);
+    }
 }
 
-int main() {
+/*
+Step 3c: with chance changeChance the group nudges its tax and segmentation rates by 0.1 each,
+in a direction picked by two coin flips. Shared by both engines, hence the template.
+*/
+template <typename GroupType>
+void changeInstitutions(GroupType& group, float changeChance, RandomStream& rng) {
     /*
-    Getting the main simulation up and running
+    0 = increase tax rate, increase seg rate
+    1 = increase tax rate, decrease seg rate
+    2 = decrease tax rate, increase seg rate
+    3 = decrease tax rate, decrease seg rate
     */
+    int flips = rng.below(4);
+    float institutionalChange = rng.uniform();
 
-    //Start by creating a vector of groups
-    std::vector<Group> world;
+    if (institutionalChange <= changeChance && flips == 0 && group.getTaxRate() <= 0.9 && group.getSegRate() <= 0.4) {//1 = heads, increase
+        group.setInstitutions(group.getTaxRate() + 0.1, group.getSegRate() + 0.1);
+    } else if (institutionalChange <= changeChance && flips == 1 && group.getSegRate() >= 0.1 && group.getTaxRate() <= 0.9) {
+        group.setInstitutions(group.getTaxRate() + 0.1, group.getSegRate() - 0.1);
+    } else if (institutionalChange <= changeChance && flips == 2  && group.getTaxRate() >= 0.1 && group.getSegRate() <= 0.4) {
+        group.setInstitutions(group.getTaxRate() - 0.1, group.getSegRate() + 0.1);
+    } else if (institutionalChange <= changeChance && flips == 3 && group.getSegRate() >= 0.1 && group.getTaxRate() >= 0.1) {
+        group.setInstitutions(group.getTaxRate() - 0.1, group.getSegRate() - 0.1);
+    }
+}
 
-    auto seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
-    std::mt19937 randomizer;
-    randomizer.seed((unsigned long)seed);
+/*
+Step 3b and 3c of the algorithm
+*/
+template <typename Game>
+void haveChildren(BasicGroup<Game>& group, RandomStream& rng, const Params& params, ReproductionMode mode = ReproductionMode::Alias) {
+    //record how the group did in the game before the parents are replaced; this is what conflicts are fought over
+    group.updateGroupData();
 
-    std::poisson_distribution<> pois(AGENTS_MULTIPLIER); //Poisson noise
-    int totalAgents (0);
+    const Population<Game>& parents = group.getAgents();
+    Population<Game>& childPool = group.nextAgents; //swapped in below, so parents and children ping-pong
+    childPool.clear();
+    childPool.reserve(parents.size());
 
-    for (int i (0); i < INITIAL_GROUPS; ++i) {
-        // propCoop, taxRate, segRate, totalPayoff, groupSize
-        Group group (0, 0, 0, 0, 0); //setting groups to be of zero size for a second
-        int numAgents = pois(randomizer); //average group size is 20, but with Poisson noise
+    if (mode == ReproductionMode::Binomial) {
+        drawChildrenBinomial(parents, childPool, params.individualMutationRate, rng);
+    }
+    else {
+        drawChildrenAlias(parents, childPool, params.individualMutationRate, rng);
+    }
 
-        if (numAgents < 4) {
-            numAgents = 4;
-            totalAgents += 4;
-        }
+    group.overhaulAgents(childPool);
+    group.updateComposition();
 
-        for (int i (0); i < numAgents; ++i) {
-            Agent agent ('d', 0);
-            group.addAgent(agent);
-            totalAgents++;
-        }
+    changeInstitutions(group, params.institutionalChangeChance, rng);
+}
 
-        world.push_back(group);
-    }
+/*
+Skip-ahead for monomorphic groups, where everyone plays the same strategy (most groups, most of the time, once
+a run has settled down). Nothing in the game depends on who is paired with whom then: everyone plays their
+own kind, so the group's total payoff is X(1 + T) per agent who gets to play (X being the strategy's payoff
+against itself), and only the one left out when the random pool is odd misses out. That happens with chance
+(1 - (2s - 1)^n) / 2, s being the chance to be segmented, so it's one draw instead of a pass over the group.
+Likewise every child has a parent of that strategy, so children only differ by mutation: instead of a draw
+per child we jump straight from one mutant to the next, the gaps between them being geometric, which usually
+means straight past the end of the group. Payoffs aren't written out per agent, but nobody reads them before
+they're reset anyway. The group's totals and children come out with exactly the distribution the full phases
+give them (the same 24-bit chances included), just not from the same random numbers.
 
-    //std::binomial_distribution<> war (INITIAL_GROUPS, GROUP_CONFLICT_CHANCE); //deprecated
+Returns false, having done nothing, if the group isn't monomorphic.
+*/
+template <typename Game>
+bool playMonomorphic(BasicGroup<Game>& group, RandomStream& playRng, RandomStream& reproduceRng, const Params& params) {
+    Population<Game>& agents = group.agents;
+    size_t n (agents.size());
+    if (n == 0) {
+        return false;
+    }
+    Trait strategy (agents.getTrait(0));
+    if (agents.countStrategy(strategy) != n) {
+        return false;
+    }
 
-    //define the file output stuff
-    std::ofstream outf ("data.csv");
-    float pCoop;
-    float avgTRate;
-    float avgSRate;
+    //the full phases' chances, as uniform() <= rate comes out with 24-bit uniforms
+    auto chanceAtMost = [](float rate) {
+        return std::clamp((std::floor((double) rate * 0x1p24) + 1) * 0x1p-24, 0.0, 1.0);
+    };
 
+    float T (group.getTaxRate());
+    float segRate (group.getSegRate());
+    double oddChance ((1 - std::pow(2 * chanceAtMost(segRate) - 1, (double) n)) / 2);
+    size_t played (n - (playRng() * 0x1p-32 < oddChance ? 1 : 0));
+    float X (Game::PAYOFF[strategy][strategy]);
+    float cost (0.5 * (segRate * segRate + T * T));
+    group.totalPayoff = X * (1 + T) * (float) played - cost * (float) n;
 
-    if (!outf) {
-        std::cerr << "Well, cock. Some C++ nonsense means the file output didn't work.\n";
-        return 1;
+    double logNoMutation (std::log1p(-chanceAtMost(params.individualMutationRate)));
+    size_t next (0);
+    bool mutated (false);
+    while (next < n) {
+        double u ((reproduceRng() + 0.5) * 0x1p-32); //on (0, 1)
+        double gap (std::floor(std::log(u) / logNoMutation));
+        if (!(gap < (double) (n - next))) {
+            break;
+        }
+        next += (size_t) gap;
+        agents.setTrait(next, mutate<Game>(strategy, reproduceRng));
+        mutated = true;
+        ++next;
+    }
+    if (mutated) {
+        group.updateComposition();
     }
 
-    outf << "Time,Proportion of Cooperators,Average Tax Rate,Average Segmentation Rate,Conflict Chance" << std::endl;
+    changeInstitutions(group, params.institutionalChangeChance, reproduceRng);
+    return true;
+}
 
+/*
+The winner of a conflict imposes its institutions on the loser and repopulates it: the loser's members are
+replaced by fresh agents in the winner's mix of strategies, and the enlarged pool is then split at a random
+point (each side keeps at least GROUP_SIZE_LOWER_BOUND agents).
 
-    int iterations; //how many times to repeat the simulation
-    std::cout << "How many interations?" << std::endl; //quality of life
-    std::cin >> iterations;
+The replacements line up by strategy from the highest code down (so cooperators before defectors), each
+strategy getting its share of the loser's size rounded down and defectors the rest.
+*/
 
-    std::vector<float> conflictChance;
-    conflictChance.push_back(GROUP_CONFLICT_CHANCE);
+//appends replacements [from, to) of that line-up, replacements[c] being how many play strategy c
+template <typename Game>
+void appendReplacements(Population<Game>& agents, const size_t* replacements, size_t from, size_t to) {
+    size_t start (0);
+    for (int c (Game::STRATEGIES - 1); c >= 0; --c) {
+        size_t end (start + replacements[c]);
+        size_t first (std::max(start, from));
+        size_t last (std::min(end, to));
+        if (first < last) {
+            agents.appendCopies((Trait) c, 0, last - first);
+        }
+        start = end;
+    }
+}
 
-    std::uniform_real_distribution<> sigma(-0.02, 0.02);
+template <typename Game>
+void absorbGroup(BasicGroup<Game>& winner, BasicGroup<Game>& loser, RandomStream& rng) {
+    loser.setInstitutions(winner.getTaxRate(), winner.getSegRate());
 
-    //auto-regressive group conflict chance
-    float averageConflictChance (0);
-    float currentConflictChance;
-    for (int m (1); m < iterations; ++m) {
-        currentConflictChance = 0.99 * conflictChance[m - 1] + sigma(randomizer);
-        conflictChance.push_back(currentConflictChance);
-        averageConflictChance += currentConflictChance;
+    size_t winnerSize (winner.getSize());
+    size_t loserSize (loser.getSize());
+    size_t replacements[Game::STRATEGIES];
+    size_t assigned (0);
+    for (int c (Game::STRATEGIES - 1); c > 0; --c) {
+        float share = winnerSize > 0 ? (float) winner.agents.countStrategy((Trait) c) / (float) winnerSize : 0;
+        replacements[c] = std::min((size_t) ((float) loserSize * share), loserSize - assigned);
+        assigned += replacements[c];
     }
+    replacements[0] = loserSize - assigned;
 
-    averageConflictChance /= iterations;
+    /*
+    The enlarged pool to split between groups is the winner's members followed by the loser's replacements.
+    We never build it: both groups are rewritten in place from where the split falls.
+    */
+    size_t poolSize (winnerSize + loserSize);
+    size_t splitRange (poolSize - 2 * GROUP_SIZE_LOWER_BOUND + 1);
 
-    float conflictChanceCorrection = GROUP_CONFLICT_CHANCE - averageConflictChance;
+    size_t sizeLoser = GROUP_SIZE_LOWER_BOUND + rng.below((std::uint32_t) splitRange); //pick a random index to split groups 1 and 2
 
-    for (int n (0); n < iterations; ++n) {
-        conflictChance[n] += conflictChanceCorrection;
+    //split groups randomly, I think
+    Population<Game>& winnerAgents = winner.agents;
+    Population<Game>& loserAgents = loser.agents;
+    if (sizeLoser <= loserSize) {
+        //the split falls among the replacements: the winner keeps its members and the first few replacements
+        size_t keptReplacements (loserSize - sizeLoser);
+        appendReplacements(winnerAgents, replacements, 0, keptReplacements);
+        loserAgents.clear();
+        appendReplacements(loserAgents, replacements, keptReplacements, loserSize);
+    }
+    else {
+        //the split falls among the winner's members: the loser gets the last few of them plus all the replacements
+        size_t moved (sizeLoser - loserSize);
+        loserAgents.clear();
+        loserAgents.append(winnerAgents, winnerSize - moved, winnerSize);
+        appendReplacements(loserAgents, replacements, 0, loserSize);
+        winnerAgents.truncate(winnerSize - moved);
     }
 
-    for (int j (0); j < iterations; ++j) { //Now run everything
+    winner.updateGroupData();
+    loser.updateGroupData();
+}
 
-    std::binomial_distribution<> war (INITIAL_GROUPS, conflictChance[j]);
+/*
+Define how the game works for groups. Note that not every group participates in conflict, a group is drawn in
+with chance Params::groupConflictChance (defined way above)
+*/
+template <typename Game>
+void playGroupGame(BasicGroup<Game>& groupOne, BasicGroup<Game>& groupTwo, RandomStream& rng) {
+    if (groupOne.getTotalPayoff() >= groupTwo.getTotalPayoff()) {//arbitrarily break ties in favor of group 1. randomize going forward?
+        absorbGroup(groupOne, groupTwo, rng);
+    } //group one wins
+    else {
+        absorbGroup(groupTwo, groupOne, rng);
+    } //group two wins
+}
 
-        //reset output values
-        pCoop = 0;
-        avgTRate = 0;
-        avgSRate = 0;
+/*
+The count engine. Agents only differ by trait and nobody carries anything from one generation to the next,
+so a group is completely described by how many cooperators and defectors it has plus its institutions.
+CountGroup keeps just that, and the three phases below draw whole pools at once (binomial for segmentation
+and children, hypergeometric for the random pairing and the conflict split), so the work per group doesn't grow
+with group size. It follows exactly the same rules as Group and the per-agent phases above, which remain the
+reference: pick one or the other with --engine.
+*/
 
-            for (int k (0); k < INITIAL_GROUPS; ++k) { //Within-group phases
-            playWithinGroup(world[k]);
-            haveChildren(world[k]);
-            }
+class CountGroup {
+public:
+    float proportionCooperative;
+    float taxRate;
+    float segmentationRate;
+    float totalPayoff; //total payoff minus institution costs, as in Group
+    std::int64_t numCooperators;
+    std::int64_t numDefectors;
+    double cooperatorPayoff; //payoff earned by all the cooperators together in the last game
+    double defectorPayoff;
+    std::uint32_t id = 0;
+    bool statsChanged = true;
 
-            //for the war, shuffle the world and choose the first warSize groups
-            std::shuffle(world.begin(), world.end(), randomizer);
-            int warSize = war(randomizer);
+    CountGroup() {
+        proportionCooperative = 0;
+        taxRate = 0;
+        segmentationRate = 0;
+        totalPayoff = 0;
+        numCooperators = 0;
+        numDefectors = 0;
+        cooperatorPayoff = 0;
+        defectorPayoff = 0;
+    }
 
-            if (warSize % 2 != 0) {
-                ++warSize;
-            }
+    size_t getSize() const {
+        return (size_t) (numCooperators + numDefectors);
+    }
+
+    void addAgent(const Agent& a) {
+        if (a.getTrait() == COOPERATE) {
+            ++numCooperators;
+        }
+        else {
+            ++numDefectors;
+        }
+        updateComposition();
+    }
+
+    void setCounts(std::int64_t cooperators, std::int64_t defectors) {
+        numCooperators = cooperators;
+        numDefectors = defectors;
+        updateComposition();
+    }
+
+    void updateComposition() {
+        std::int64_t size (numCooperators + numDefectors);
+        proportionCooperative = size > 0 ? (float) numCooperators / (float) size : 0;
+        statsChanged = true;
+    }
+
+    float institutionCost() const {
+        return 0.5f * (segmentationRate * segmentationRate + taxRate * taxRate);
+    }
+
+    float getTotalPayoff() const {
+        return totalPayoff;
+    }
+
+    float getPropCoop() const {
+        return proportionCooperative;
+    }
+
+    size_t getCooperators() const {
+        return (size_t) numCooperators;
+    }
+
+    float getTaxRate() const {
+        return taxRate;
+    }
+
+    float getSegRate() const {
+        return segmentationRate;
+    }
+
+    void setInstitutions(float tR, float sR) {
+        taxRate = tR;
+        segmentationRate = sR;
+        statsChanged = true;
+    }
+};
+
+/*
+Same game as playWithinGroup(Group&), in counts. Each agent is segmented with chance segRate, so the segmented
+pools are binomial. The random pool, less one agent if it's odd, is paired uniformly at random: think of it
+as a shuffled line paired off (1,2), (3,4), ... The cooperators among the first members of each pair are
+hypergeometric, and so is how many of them land a cooperator partner, which gives the CC/CD/DD pair counts.
+*/
+void playWithinGroup(CountGroup& group, RandomStream& rng) {
+    double T (group.getTaxRate());
+    double segRate (group.getSegRate());
+    std::int64_t numCoop (group.numCooperators);
+    std::int64_t numDef (group.numDefectors);
+    std::int64_t size (numCoop + numDef);
+
+    std::int64_t segmentedCoop (drawBinomial(numCoop, segRate, rng));
+    std::int64_t segmentedDef (drawBinomial(numDef, segRate, rng));
+    std::int64_t poolCoop (numCoop - segmentedCoop);
+    std::int64_t poolDef (numDef - segmentedDef);
+
+    //an odd random pool leaves somebody out
+    if ((poolCoop + poolDef) % 2 != 0) {
+        if ((std::int64_t) rng.below((std::uint32_t) (poolCoop + poolDef)) < poolCoop) {
+            --poolCoop;
+        }
+        else {
+            --poolDef;
+        }
+    }
+
+    std::int64_t numPairs ((poolCoop + poolDef) / 2);
+    std::int64_t firstCoop (drawHypergeometric(poolCoop, poolDef, numPairs, rng));
+    std::int64_t pairsCC (drawHypergeometric(poolCoop - firstCoop, numPairs - (poolCoop - firstCoop), firstCoop, rng));
+    std::int64_t pairsCD (poolCoop - 2 * pairsCC);
+    std::int64_t pairsDD ((poolDef - pairsCD) / 2);
+
+    double R (REWARD_FOR_COOPERATION), S (SUCKERS_PAYOFF), Tt (TEMPTATION_TO_DEFECT), P (MUTUAL_PUNISHMENT);
+    double coopPayoff (segmentedCoop * (1 - T) * R + 2 * pairsCC * R + pairsCD * S);
+    double defPayoff (segmentedDef * (1 - T) * P + pairsCD * Tt + 2 * pairsDD * P);
+    double taxPool (segmentedCoop * 2 * T * R + segmentedDef * 2 * T * P
+                    + pairsCC * 2 * T * R + pairsCD * T * (S + Tt) + pairsDD * 2 * T * P);
+
+    double transfer (size > 0 ? taxPool / (double) size : 0);
+    group.cooperatorPayoff = coopPayoff + numCoop * transfer;
+    group.defectorPayoff = defPayoff + numDef * transfer;
+}
+
+void haveChildren(CountGroup& group, RandomStream& rng, const Params& params) {
+    std::int64_t size (group.numCooperators + group.numDefectors);
+    double allPayoff (group.cooperatorPayoff + group.defectorPayoff);
+    group.totalPayoff = (float) (allPayoff - group.institutionCost() * size);
+
+    double pC = allPayoff > 0 ? group.cooperatorPayoff / allPayoff : (double) group.numCooperators / (double) size;
+    double q = pC * (1 - params.individualMutationRate) + (1 - pC) * params.individualMutationRate;
+    std::int64_t children (drawBinomial(size, std::clamp(q, 0.0, 1.0), rng));
+    group.setCounts(children, size - children);
+    group.cooperatorPayoff = 0; //children haven't played yet
+    group.defectorPayoff = 0;
+
+    changeInstitutions(group, params.institutionalChangeChance, rng);
+}
+
+/*
+absorbGroup in counts. The pool is the winner's members (in random order, they are fresh children) followed by
+the loser's replacements, cooperators first. The loser takes the last sizeLoser of it, so it gets the tail of the
+replacements and, if it takes more than that, a random handful of the winner's members.
+*/
+void absorbGroup(CountGroup& winner, CountGroup& loser, RandomStream& rng) {
+    loser.setInstitutions(winner.getTaxRate(), winner.getSegRate());
+
+    std::int64_t winnerSize ((std::int64_t) winner.getSize());
+    std::int64_t loserSize ((std::int64_t) loser.getSize());
+    std::int64_t numCoopLoser = (std::int64_t) ((float) loserSize * winner.getPropCoop());
+    std::int64_t poolSize (winnerSize + loserSize);
+    std::int64_t splitRange (poolSize - 2 * GROUP_SIZE_LOWER_BOUND + 1);
+    std::int64_t sizeLoser = GROUP_SIZE_LOWER_BOUND + rng.below((std::uint32_t) splitRange);
+
+    std::int64_t loserCoop, winnerCoop;
+    if (sizeLoser <= loserSize) {
+        std::int64_t replacementDef (loserSize - numCoopLoser);
+        std::int64_t tailDef (std::min(sizeLoser, replacementDef));
+        loserCoop = sizeLoser - tailDef;
+        winnerCoop = winner.numCooperators + (numCoopLoser - loserCoop);
+    }
+    else {
+        std::int64_t fromWinner (sizeLoser - loserSize);
+        std::int64_t movedCoop (drawHypergeometric(winner.numCooperators, winner.numDefectors, fromWinner, rng));
+        loserCoop = numCoopLoser + movedCoop;
+        winnerCoop = winner.numCooperators - movedCoop;
+    }
+
+    winner.setCounts(winnerCoop, poolSize - sizeLoser - winnerCoop);
+    loser.setCounts(loserCoop, sizeLoser - loserCoop);
+    //as in Group::updateGroupData after a conflict: nobody has played yet, so only the institution cost counts
+    winner.totalPayoff = -winner.institutionCost() * (float) winner.getSize();
+    loser.totalPayoff = -loser.institutionCost() * (float) loser.getSize();
+}
+
+void playGroupGame(CountGroup& groupOne, CountGroup& groupTwo, RandomStream& rng) {
+    if (groupOne.getTotalPayoff() >= groupTwo.getTotalPayoff()) {
+        absorbGroup(groupOne, groupTwo, rng);
+    }
+    else {
+        absorbGroup(groupTwo, groupOne, rng);
+    }
+}
+
+/*
+A small work-stealing thread pool for running the groups in parallel. parallelFor cuts [0, n) into chunks and
+deals them round-robin onto one deque per worker; a worker takes chunks off the front of its own deque and,
+once that runs dry, steals from the back of somebody else's. Group sizes are Poisson to begin with and drift
+apart after conflicts, so an even static split would leave most threads waiting on whoever got the big groups.
+The calling thread works too, so a pool of size 1 just runs the loop inline.
+*/
+
+//the most threads --threads takes: far more than any machine this runs on, well short of running out of stacks
+const unsigned MAX_THREADS = 4096;
+
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned numThreads) {
+        if (numThreads == 0) {
+            numThreads = 1;
+        }
+        queues = std::vector<WorkQueue>(numThreads);
+        try {
+            for (unsigned t (1); t < numThreads; ++t) {
+                workers.emplace_back([this, t] { workerLoop(t); });
+            }
+        }
+        catch (...) {
+            //the system wouldn't start another thread; the ones already going have to stop before we give up
+            stopWorkers();
+            throw;
+        }
+    }
+
+    ~ThreadPool() {
+        stopWorkers();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+
+    unsigned size() const {
+        return (unsigned) queues.size();
+    }
+
+    //runs body(i) for every i in [0, n) and returns once all of them have finished
+    template <typename Body>
+    void parallelFor(size_t n, Body&& body) {
+        if (n == 0) {
+            return;
+        }
+        if (queues.size() == 1) {
+            for (size_t i (0); i < n; ++i) {
+                body(i);
+            }
+            return;
+        }
+
+        size_t numChunks = std::min(n, queues.size() * CHUNKS_PER_WORKER); //a few chunks each so there is something to steal
+        size_t chunkSize = (n + numChunks - 1) / numChunks;
+        numChunks = (n + chunkSize - 1) / chunkSize;
+
+        //type-erased by hand rather than with std::function, which would allocate for a capturing lambda
+        currentBody = &body;
+        runBody = [](void* b, size_t i) { (*static_cast<std::remove_reference_t<Body>*>(b))(i); };
+        remaining.store(numChunks);
+        for (size_t c (0); c < numChunks; ++c) {
+            WorkQueue& queue = queues[c % queues.size()];
+            std::lock_guard<std::mutex> lock (queue.mutex);
+            queue.chunks[queue.tail++] = {c * chunkSize, std::min(n, (c + 1) * chunkSize)};
+        }
+        {
+            std::lock_guard<std::mutex> lock (stateMutex);
+            ++epoch;
+        }
+        wakeWorkers.notify_all();
+
+        runChunks(0);
+
+        std::unique_lock<std::mutex> lock (stateMutex);
+        jobDone.wait(lock, [this] { return remaining.load() == 0; });
+    }
+
+private:
+    struct Chunk {
+        size_t begin;
+        size_t end;
+    };
+
+    static const size_t CHUNKS_PER_WORKER = 8;
+
+    //a fixed-size deque: every job empties the queues before the next one fills them, so this never wraps
+    struct WorkQueue {
+        std::mutex mutex;
+        Chunk chunks[CHUNKS_PER_WORKER];
+        size_t head = 0;
+        size_t tail = 0;
+    };
+
+    std::vector<WorkQueue> queues;
+    std::vector<std::thread> workers;
+    std::mutex stateMutex;
+    std::condition_variable wakeWorkers;
+    std::condition_variable jobDone;
+    std::atomic<size_t> remaining {0};
+    void* currentBody = nullptr;
+    void (*runBody)(void*, size_t) = nullptr;
+    std::uint64_t epoch = 0;
+    bool stopping = false;
+
+    bool takeChunk(unsigned self, Chunk& chunk) {
+        {
+            WorkQueue& own = queues[self];
+            std::lock_guard<std::mutex> lock (own.mutex);
+            if (own.head < own.tail) {
+                chunk = own.chunks[own.head++];
+                if (own.head == own.tail) {
+                    own.head = own.tail = 0;
+                }
+                return true;
+            }
+        }
+        for (size_t offset (1); offset < queues.size(); ++offset) {
+            WorkQueue& victim = queues[(self + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock (victim.mutex);
+            if (victim.head < victim.tail) {
+                chunk = victim.chunks[--victim.tail];
+                if (victim.head == victim.tail) {
+                    victim.head = victim.tail = 0;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void runChunks(unsigned self) {
+        Chunk chunk;
+        while (takeChunk(self, chunk)) {
+            for (size_t i (chunk.begin); i < chunk.end; ++i) {
+                runBody(currentBody, i);
+            }
+            if (remaining.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock (stateMutex);
+                jobDone.notify_all();
+            }
+        }
+    }
+
+    void stopWorkers() {
+        {
+            std::lock_guard<std::mutex> lock (stateMutex);
+            stopping = true;
+        }
+        wakeWorkers.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    void workerLoop(unsigned self) {
+        std::uint64_t seenEpoch (0);
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock (stateMutex);
+                wakeWorkers.wait(lock, [&] { return stopping || epoch != seenEpoch; });
+                if (stopping) {
+                    return;
+                }
+                seenEpoch = epoch;
+            }
+            runChunks(self);
+        }
+    }
+};
+
+/*
+Spatial structure (--topology). By default any two groups can end up fighting; with a topology, conflicts only
+happen between neighbours: on a ring, on a 2-D lattice (wrapped round into a torus, four neighbours each), or on
+any graph read from a file. The graph is kept in compressed sparse rows: group g's neighbours are
+neighbours[offsets[g]] to neighbours[offsets[g + 1] - 1].
+
+Groups are numbered, and so stored, in an order that keeps neighbours close together in memory: a lattice's
+cells in the order a Hilbert curve visits them, and a file's nodes in reverse Cuthill-McKee order (breadth
+first from a low-degree node, which keeps every node's neighbours within a narrow band of its own number).
+node maps a group back to where it sits in the topology: its position on the ring, y * width + x on the
+lattice, or its number in the file.
+*/
+struct Topology {
+    std::string kind;
+    std::uint32_t width = 0; //lattice only
+    std::uint32_t height = 0;
+    std::vector<std::uint32_t> offsets;
+    std::vector<std::uint32_t> neighbours;
+    std::vector<std::uint32_t> node;
+
+    size_t size() const {
+        return node.size();
+    }
+
+    std::span<const std::uint32_t> neighboursOf(size_t g) const {
+        return std::span<const std::uint32_t>(neighbours.data() + offsets[g], offsets[g + 1] - offsets[g]);
+    }
+};
+
+//distance along the Hilbert curve filling a side x side square (side a power of two) to cell (x, y)
+std::uint64_t hilbertIndex(std::uint32_t side, std::uint32_t x, std::uint32_t y) {
+    std::uint64_t d (0);
+    for (std::uint32_t s (side / 2); s > 0; s /= 2) {
+        std::uint32_t rx ((x & s) > 0 ? 1 : 0);
+        std::uint32_t ry ((y & s) > 0 ? 1 : 0);
+        d += (std::uint64_t) s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = side - 1 - x;
+                y = side - 1 - y;
+            }
+            std::swap(x, y);
+        }
+    }
+    return d;
+}
+
+//builds the rows from undirected edges between nodes, with node[g] the node that becomes group g
+void buildTopology(Topology& topology, const std::vector<std::pair<std::uint32_t, std::uint32_t>>& edges) {
+    size_t n (topology.node.size());
+    std::vector<std::uint32_t> group (n);
+    for (size_t g (0); g < n; ++g) {
+        group[topology.node[g]] = (std::uint32_t) g;
+    }
+    std::vector<std::uint32_t> degree (n + 1, 0);
+    for (auto [a, b] : edges) {
+        if (a != b) {
+            ++degree[group[a]];
+            ++degree[group[b]];
+        }
+    }
+    topology.offsets.assign(n + 1, 0);
+    for (size_t g (0); g < n; ++g) {
+        topology.offsets[g + 1] = topology.offsets[g] + degree[g];
+    }
+    topology.neighbours.resize(topology.offsets[n]);
+    std::vector<std::uint32_t> filled (topology.offsets.begin(), topology.offsets.end() - 1);
+    for (auto [a, b] : edges) {
+        if (a != b) {
+            topology.neighbours[filled[group[a]]++] = group[b];
+            topology.neighbours[filled[group[b]]++] = group[a];
+        }
+    }
+
+    //sorted rows without repeats (a small ring or lattice meets the same neighbour from both sides)
+    std::uint32_t kept (0);
+    std::uint32_t rowStart (0);
+    for (size_t g (0); g < n; ++g) {
+        std::uint32_t* first = topology.neighbours.data() + rowStart;
+        std::uint32_t* last = topology.neighbours.data() + topology.offsets[g + 1];
+        std::sort(first, last);
+        last = std::unique(first, last);
+        rowStart = topology.offsets[g + 1];
+        topology.offsets[g] = kept;
+        for (std::uint32_t* it (first); it != last; ++it) {
+            topology.neighbours[kept++] = *it;
+        }
+    }
+    topology.offsets[n] = kept;
+    topology.neighbours.resize(kept);
+}
+
+/*
+Makes the topology spec describes (ring, lattice, or the path of an edge list: one "a b" pair of node numbers per
+line, # starting a comment, nodes numbered from 0) for a world of groups groups. A lattice is as square as the
+number of groups allows. Returns false with a reason in error if it can't.
+*/
+bool makeTopology(const std::string& spec, size_t groups, Topology& topology, std::string& error) {
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> edges;
+    topology = Topology();
+    if (spec == "ring") {
+        topology.kind = "ring";
+        topology.node.resize(groups);
+        std::iota(topology.node.begin(), topology.node.end(), 0u);
+        for (size_t g (0); g < groups; ++g) {
+            edges.push_back({(std::uint32_t) g, (std::uint32_t) ((g + 1) % groups)});
+        }
+    }
+    else if (spec == "lattice") {
+        std::uint32_t width (1);
+        for (std::uint32_t w (1); (size_t) w * w <= groups; ++w) {
+            if (groups % w == 0) {
+                width = w;
+            }
+        }
+        std::uint32_t height ((std::uint32_t) (groups / width));
+        topology.kind = "lattice";
+        topology.width = width;
+        topology.height = height;
+        std::uint32_t side (std::bit_ceil(std::max(width, height)));
+        topology.node.resize(groups);
+        std::iota(topology.node.begin(), topology.node.end(), 0u);
+        std::sort(topology.node.begin(), topology.node.end(), [&](std::uint32_t a, std::uint32_t b) {
+            return hilbertIndex(side, a % width, a / width) < hilbertIndex(side, b % width, b / width);
+        });
+        for (std::uint32_t y (0); y < height; ++y) {
+            for (std::uint32_t x (0); x < width; ++x) {
+                edges.push_back({y * width + x, y * width + (x + 1) % width});
+                edges.push_back({y * width + x, ((y + 1) % height) * width + x});
+            }
+        }
+    }
+    else {
+        std::ifstream in (spec);
+        if (!in) {
+            error = "couldn't read " + spec + " (a topology is ring, lattice or an edge list file)";
+            return false;
+        }
+        std::string line;
+        std::uint32_t nodes (0);
+        for (int lineNumber (1); std::getline(in, line); ++lineNumber) {
+            line = line.substr(0, line.find('#'));
+            std::stringstream fields (line);
+            long long a, b;
+            if (!(fields >> a)) {
+                continue;
+            }
+            std::string rest;
+            if (!(fields >> b) || (fields >> rest) || a < 0 || b < 0 || a >= (long long) groups || b >= (long long) groups) {
+                error = spec + " line " + std::to_string(lineNumber) + ": expected two node numbers from 0 to "
+                        + std::to_string(groups - 1) + " (--groups has to match the graph's number of nodes)";
+                return false;
+            }
+            edges.push_back({(std::uint32_t) a, (std::uint32_t) b});
+            nodes = std::max(nodes, (std::uint32_t) std::max(a, b) + 1);
+        }
+        if (nodes != groups) {
+            error = spec + " has " + std::to_string(nodes) + " nodes but there are " + std::to_string(groups) + " groups; pass --groups "
+                    + std::to_string(nodes);
+            return false;
+        }
+        topology.kind = "graph";
+
+        //reverse Cuthill-McKee, one connected piece at a time
+        std::vector<std::uint32_t> degree (groups, 0);
+        std::vector<std::vector<std::uint32_t>> adjacent (groups);
+        for (auto [a, b] : edges) {
+            if (a != b) {
+                adjacent[a].push_back(b);
+                adjacent[b].push_back(a);
+            }
+        }
+        for (size_t v (0); v < groups; ++v) {
+            degree[v] = (std::uint32_t) adjacent[v].size();
+            std::sort(adjacent[v].begin(), adjacent[v].end(), [&](std::uint32_t a, std::uint32_t b) {
+                return adjacent[a].size() < adjacent[b].size() || (adjacent[a].size() == adjacent[b].size() && a < b);
+            });
+        }
+        std::vector<std::uint32_t> byDegree (groups);
+        std::iota(byDegree.begin(), byDegree.end(), 0u);
+        std::stable_sort(byDegree.begin(), byDegree.end(), [&](std::uint32_t a, std::uint32_t b) { return degree[a] < degree[b]; });
+        std::vector<bool> placed (groups, false);
+        for (std::uint32_t start : byDegree) {
+            if (placed[start]) {
+                continue;
+            }
+            size_t head (topology.node.size());
+            topology.node.push_back(start);
+            placed[start] = true;
+            for (; head < topology.node.size(); ++head) {
+                for (std::uint32_t next : adjacent[topology.node[head]]) {
+                    if (!placed[next]) {
+                        placed[next] = true;
+                        topology.node.push_back(next);
+                    }
+                }
+            }
+        }
+        std::reverse(topology.node.begin(), topology.node.end());
+    }
+    buildTopology(topology, edges);
+    return true;
+}
+
+/*
+The world loop, written once for both engines (GroupType is Group or CountGroup).
+*/
+
+struct RunOptions {
+    std::uint64_t seed;
+    Params params;
+    ReproductionMode reproductionMode = ReproductionMode::Alias; //only the per-agent engine picks parents
+    bool countAllocations = false; //report heap allocations made by the generation loop
+    bool streaming = false; //make the conflict chance as the run goes, see ConflictChanceSeries
+    int outputEvery = 1; //write every nth generation
+    int outputWindow = 0; //if > 0, write the mean and spread over each window of this many generations instead
+    GameKind game = GameKind::PrisonersDilemma; //the per-agent engine's game
+    bool skipAhead = true; //closed-form phases for monomorphic groups, see playMonomorphic
+    bool distributions = false; //add the WorldDistribution columns to the CSV
+    const Topology* topology = nullptr; //conflicts only between neighbours on this, if there is one
+    double precision = 0; //if > 0, stop once the long-run cooperation is known to within this, see ConvergenceMonitor
+    int minGenerations = 2500; //but not before this, see ConvergenceMonitor
+};
+
+//world-level averages reported every generation
+struct WorldStats {
+    float pCoop = 0;
+    float avgTRate = 0;
+    float avgSRate = 0;
+};
+
+/*
+World statistics, kept up to date from what changed instead of recomputed from scratch. A group raises its
+statsChanged flag whenever updateComposition or setInstitutions touches it; runGeneration passes the flagged
+groups to collect() as it goes, and update() then swaps each one's old contribution to the totals for its new
+one. Once a run settles most groups are monomorphic and sit still from one generation to the next, so keeping
+the distributions below costs O(changed groups) a generation rather than another pass over the world.
+
+Everything is summed in integers (the groups' shares and rates in 32.32 fixed point), so the totals neither
+drift over a long run nor depend on the order the threads report groups in. Besides the group-weighted means
+that have always been the output, it keeps the agent-weighted cooperator share, a histogram of groups over the
+0.1-step tax x segmentation grid the institutions move on, and the group sizes in a Fenwick tree for quantiles.
+*/
+
+//plain-bytes message building, for what sharded runs send each other (see runShards)
+void appendBytes(std::vector<char>& out, const void* data, size_t n) {
+    const char* bytes = static_cast<const char*>(data);
+    out.insert(out.end(), bytes, bytes + n);
+}
+
+template <typename T>
+void readBytes(const char*& in, T& value) {
+    std::memcpy(&value, in, sizeof(T));
+    in += sizeof(T);
+}
+
+const int TAX_BINS = 11; //tax rates 0, 0.1, ..., 1
+const int SEG_BINS = 6; //segmentation rates 0, 0.1, ..., 0.5
+const int SIZE_QUANTILES = 5;
+const double SIZE_QUANTILE_POINTS[SIZE_QUANTILES] = {0, 0.1, 0.5, 0.9, 1};
+
+//the distributions behind the world averages, for the output
+struct WorldDistribution {
+    float agentCoop = 0; //cooperators over all agents, rather than the mean of the groups' shares
+    std::uint32_t sizeQuantiles[SIZE_QUANTILES] = {}; //min, 10%, median, 90% and max group size
+    std::uint32_t institutions[TAX_BINS * SEG_BINS] = {}; //groups in each (tax, seg) cell, tax-major
+};
+
+class WorldStatistics {
+public:
+    //starts over from the whole world, for a new or restored one
+    template <typename GroupType>
+    void rebuild(std::vector<GroupType>& world) {
+        numGroups = world.size();
+        totals = Totals();
+        //every group starts out counted as empty, then is replaced by what it really holds
+        contributions.assign(numGroups, Contribution());
+        std::fill(std::begin(institutions), std::end(institutions), 0);
+        institutions[0] = (std::uint32_t) numGroups;
+        sizeCounts.assign(1, (std::int64_t) numGroups);
+        rebuildSizeTree(1);
+        changed.resize(2 * numGroups); //a group reports at most twice a generation, after its own phases and after a war
+        pending.store(0);
+        updated = 0;
+        for (size_t k (0); k < numGroups; ++k) {
+            world[k].statsChanged = false;
+            replace(contributions[k], contributionOf(world[k]));
+        }
+    }
+
+    //notes group k (world[k]) for the next update if it has changed; safe from any thread, for different groups
+    template <typename GroupType>
+    void collect(GroupType& group, size_t k) {
+        if (group.statsChanged) {
+            group.statsChanged = false;
+            changed[pending.fetch_add(1, std::memory_order_relaxed)] = (std::uint32_t) k;
+        }
+    }
+
+    //brings the totals up to date with the groups collected since the last update
+    template <typename GroupType>
+    void update(const std::vector<GroupType>& world) {
+        size_t count (pending.exchange(0));
+        updated = count;
+        for (size_t i (0); i < count; ++i) {
+            std::uint32_t k (changed[i]);
+            replace(contributions[k], contributionOf(world[k])); //a group collected twice is a no-op the second time
+        }
+    }
+
+    WorldStats summary() const {
+        double groups ((double) std::max<size_t>(numGroups, 1));
+        WorldStats stats;
+        stats.pCoop = (float) ((double) totals.coopShares * 0x1p-32 / groups);
+        stats.avgTRate = (float) ((double) totals.taxRates * 0x1p-32 / groups);
+        stats.avgSRate = (float) ((double) totals.segRates * 0x1p-32 / groups);
+        return stats;
+    }
+
+    void distribution(WorldDistribution& out) const {
+        out.agentCoop = totals.agents > 0 ? (float) ((double) totals.cooperators / (double) totals.agents) : 0;
+        for (int q (0); q < SIZE_QUANTILES; ++q) {
+            //nearest rank: the smallest size at least this share of the groups are no bigger than
+            std::int64_t rank ((std::int64_t) std::ceil(SIZE_QUANTILE_POINTS[q] * (double) numGroups));
+            out.sizeQuantiles[q] = numGroups > 0 ? (std::uint32_t) sizeWithRank(std::max<std::int64_t>(rank, 1)) : 0;
+        }
+        std::copy(std::begin(institutions), std::end(institutions), std::begin(out.institutions));
+    }
+
+    //the groups the last update went through, in no particular order and some of them twice (see HistoryRecorder)
+    std::span<const std::uint32_t> lastChanged() const {
+        return std::span<const std::uint32_t>(changed.data(), updated);
+    }
+
+    /*
+    The reduction for sharded runs. Every shard pack()s its totals (with the size histogram and institution
+    grid only if the distributions are wanted), and shard 0 reset()s a spare WorldStatistics each generation
+    and unpack()s all of them into it, which then answers summary() and distribution() for the whole world.
+    The totals are integers, so this comes out exactly as if one process had counted everything.
+    */
+    void pack(std::vector<char>& out, bool distributions) const {
+        appendBytes(out, &totals, sizeof(totals));
+        if (!distributions) {
+            return;
+        }
+        appendBytes(out, institutions, sizeof(institutions));
+        std::uint64_t numSizes (std::count_if(sizeCounts.begin(), sizeCounts.end(), [](std::int64_t c) { return c != 0; }));
+        appendBytes(out, &numSizes, sizeof(numSizes));
+        for (std::uint64_t size (0); size < sizeCounts.size(); ++size) {
+            if (sizeCounts[size] != 0) {
+                appendBytes(out, &size, sizeof(size));
+                appendBytes(out, &sizeCounts[size], sizeof(std::int64_t));
+            }
+        }
+    }
+
+    void reset(size_t groups) {
+        numGroups = groups;
+        totals = Totals();
+        std::fill(std::begin(institutions), std::end(institutions), 0);
+        if (sizeCounts.empty()) {
+            sizeCounts.assign(1, 0);
+        }
+        std::fill(sizeCounts.begin(), sizeCounts.end(), 0);
+        std::fill(sizeTree.begin(), sizeTree.end(), 0);
+        rebuildSizeTree(sizeCounts.size());
+    }
+
+    void unpack(const char*& in, bool distributions) {
+        Totals shard;
+        readBytes(in, shard);
+        totals.agents += shard.agents;
+        totals.cooperators += shard.cooperators;
+        totals.coopShares += shard.coopShares;
+        totals.taxRates += shard.taxRates;
+        totals.segRates += shard.segRates;
+        if (!distributions) {
+            return;
+        }
+        std::uint32_t cells[TAX_BINS * SEG_BINS];
+        readBytes(in, cells);
+        for (int c (0); c < TAX_BINS * SEG_BINS; ++c) {
+            institutions[c] += cells[c];
+        }
+        std::uint64_t numSizes;
+        readBytes(in, numSizes);
+        for (std::uint64_t i (0); i < numSizes; ++i) {
+            std::uint64_t size;
+            std::int64_t count;
+            readBytes(in, size);
+            readBytes(in, count);
+            countSize(size, count);
+        }
+    }
+
+private:
+    //what one group adds to the totals
+    struct Contribution {
+        std::uint64_t size = 0;
+        std::uint64_t cooperators = 0;
+        std::int64_t coopShare = 0; //32.32 fixed point
+        std::int64_t taxRate = 0;
+        std::int64_t segRate = 0;
+        std::uint32_t institutionCell = 0;
+
+        bool operator== (const Contribution&) const = default;
+    };
+
+    struct Totals {
+        std::int64_t agents = 0;
+        std::int64_t cooperators = 0;
+        std::int64_t coopShares = 0;
+        std::int64_t taxRates = 0;
+        std::int64_t segRates = 0;
+    };
+
+    size_t numGroups = 0;
+    Totals totals;
+    std::vector<Contribution> contributions; //by group index
+    std::uint32_t institutions[TAX_BINS * SEG_BINS] = {};
+    std::vector<std::int64_t> sizeCounts; //groups of each size
+    std::vector<std::int64_t> sizeTree; //Fenwick tree over sizeCounts, 1-based
+    std::vector<std::uint32_t> changed; //groups collected this generation
+    std::atomic<size_t> pending {0};
+    size_t updated = 0; //how many of changed the last update went through
+
+    static std::int64_t toFixed(float value) {
+        return (std::int64_t) ((double) value * 0x1p32); //exact for anything a float in [0, 1] can hold above 2^-32
+    }
+
+    template <typename GroupType>
+    static Contribution contributionOf(const GroupType& group) {
+        Contribution c;
+        c.size = group.getSize();
+        c.cooperators = group.getCooperators();
+        c.coopShare = toFixed(group.getPropCoop());
+        c.taxRate = toFixed(group.getTaxRate());
+        c.segRate = toFixed(group.getSegRate());
+        int taxBin (std::clamp((int) (group.getTaxRate() * 10 + 0.5f), 0, TAX_BINS - 1));
+        int segBin (std::clamp((int) (group.getSegRate() * 10 + 0.5f), 0, SEG_BINS - 1));
+        c.institutionCell = (std::uint32_t) (taxBin * SEG_BINS + segBin);
+        return c;
+    }
+
+    void replace(Contribution& was, const Contribution& now) {
+        if (was == now) {
+            return;
+        }
+        totals.agents += (std::int64_t) now.size - (std::int64_t) was.size;
+        totals.cooperators += (std::int64_t) now.cooperators - (std::int64_t) was.cooperators;
+        totals.coopShares += now.coopShare - was.coopShare;
+        totals.taxRates += now.taxRate - was.taxRate;
+        totals.segRates += now.segRate - was.segRate;
+        if (now.institutionCell != was.institutionCell) {
+            --institutions[was.institutionCell];
+            ++institutions[now.institutionCell];
+        }
+        if (now.size != was.size) {
+            countSize(was.size, -1);
+            countSize(now.size, 1);
+        }
+        was = now;
+    }
+
+    void countSize(std::uint64_t size, std::int64_t delta) {
+        if (size >= sizeCounts.size()) {
+            //only when a group grows past every size seen so far, like the populations' buffers
+            sizeCounts.resize(std::bit_ceil(size + 1), 0);
+            rebuildSizeTree(sizeCounts.size());
+        }
+        sizeCounts[size] += delta;
+        for (size_t i (size + 1); i < sizeTree.size(); i += i & (~i + 1)) {
+            sizeTree[i] += delta;
+        }
+    }
+
+    void rebuildSizeTree(size_t capacity) {
+        sizeTree.assign(capacity + 1, 0);
+        for (size_t i (1); i <= capacity; ++i) {
+            sizeTree[i] += sizeCounts[i - 1];
+            size_t parent (i + (i & (~i + 1)));
+            if (parent <= capacity) {
+                sizeTree[parent] += sizeTree[i];
+            }
+        }
+    }
+
+    //the smallest size with at least rank groups no bigger than it, by walking down the Fenwick tree
+    size_t sizeWithRank(std::int64_t rank) const {
+        size_t capacity (sizeTree.size() - 1);
+        size_t position (0);
+        for (size_t step (std::bit_floor(capacity)); step > 0; step >>= 1) {
+            if (position + step <= capacity && sizeTree[position + step] < rank) {
+                position += step;
+                rank -= sizeTree[position];
+            }
+        }
+        return position; //tree index position + 1 holds size position
+    }
+};
+
+//groups [first, last) of the starting world (last < 0 for all of them)
+template <typename GroupType>
+std::vector<GroupType> makeWorld(const RunOptions& options, int first = 0, int last = -1) {
+    //Start by creating a vector of groups
+    std::vector<GroupType> world;
+    std::poisson_distribution<> pois(options.params.agentsMultiplier); //Poisson noise
+
+    //the distribution keeps state from one draw to the next, so the groups before first still have to be drawn
+    for (int i (0); i < first; ++i) {
+        RandomStream setupRng (options.seed, 0, i, Phase::Setup);
+        pois(setupRng);
+    }
+    if (last < 0) {
+        last = options.params.initialGroups;
+    }
+    for (int i (first); i < last; ++i) {
+        GroupType group; //setting groups to be of zero size for a second
+        RandomStream setupRng (options.seed, 0, i, Phase::Setup);
+        int numAgents = pois(setupRng); //average group size is 20, but with Poisson noise
+
+        if (numAgents < GROUP_SIZE_LOWER_BOUND) {
+            numAgents = GROUP_SIZE_LOWER_BOUND;
+        }
+
+        for (int i (0); i < numAgents; ++i) {
+            Agent agent (DEFECT, 0);
+            group.addAgent(agent);
+        }
+
+        group.id = i;
+        world.push_back(std::move(group));
+    }
+    return world;
+}
+
+//auto-regressive group conflict chance, shifted so that it averages baseChance over the run
+std::vector<float> makeConflictChance(std::uint64_t seed, int iterations, float baseChance) {
+    std::vector<float> conflictChance;
+    conflictChance.push_back(baseChance);
+
+    float averageConflictChance (0);
+    float currentConflictChance;
+    for (int m (1); m < iterations; ++m) {
+        RandomStream sigma (seed, m, 0, Phase::ConflictChance);
+        currentConflictChance = 0.99 * conflictChance[m - 1] + (sigma.uniform() * 0.04f - 0.02f); //noise on [-0.02, 0.02)
+        conflictChance.push_back(currentConflictChance);
+        averageConflictChance += currentConflictChance;
+    }
+
+    averageConflictChance /= iterations;
+
+    float conflictChanceCorrection = baseChance - averageConflictChance;
+
+    for (int n (0); n < iterations; ++n) {
+        conflictChance[n] += conflictChanceCorrection;
+    }
+    return conflictChance;
+}
+
+/*
+The conflict chance for each generation. Normally the whole series is made up front by makeConflictChance,
+since its mean correction needs the whole series. With --streaming it's made as the run goes, in constant
+memory: the same auto-regressive noise, started at its long-run level (no deviation from baseChance) instead
+of at baseChance plus a decay towards 0. That process already averages baseChance in expectation, so the
+correction is done analytically by not needing one. The two series differ in the first few hundred
+generations (the up-front one starts high and decays) and in the up-front one's exact sample mean.
+*/
+class ConflictChanceSeries {
+public:
+    ConflictChanceSeries(std::uint64_t seed, int iterations, float baseChance, bool streaming)
+        : seed(seed), baseChance(baseChance), streaming(streaming) {
+        if (!streaming) {
+            series = makeConflictChance(seed, iterations, baseChance);
+        }
+    }
+
+    //when streaming, j can only stay the same or go up between calls
+    float operator[](int j) {
+        if (!streaming) {
+            return series[j];
+        }
+        while (generation < j) {
+            ++generation;
+            RandomStream sigma (seed, generation, 0, Phase::ConflictChance);
+            deviation = 0.99f * deviation + (sigma.uniform() * 0.04f - 0.02f); //noise on [-0.02, 0.02)
+        }
+        return baseChance + deviation;
+    }
+
+    bool isStreaming() const {
+        return streaming;
+    }
+
+    //where the stream is, for checkpoints
+    float getDeviation() const {
+        return deviation;
+    }
+
+    //carries the stream on from a checkpoint taken at generation j
+    void restart(int j, float savedDeviation) {
+        generation = j;
+        deviation = savedDeviation;
+    }
+
+    //a new level to vary around, from the generations not yet asked for on (the deviations are the same either way)
+    void setBaseChance(float base) {
+        if (!streaming) {
+            for (float& chance : series) {
+                chance += base - baseChance;
+            }
+        }
+        baseChance = base;
+    }
+
+private:
+    std::uint64_t seed;
+    float baseChance;
+    bool streaming;
+    std::vector<float> series;
+    int generation = 0;
+    float deviation = 0;
+};
+
+template <typename Game>
+void playWithinPhases(BasicGroup<Game>& group, RandomStream& playRng, RandomStream& reproduceRng, const RunOptions& options) {
+    if (options.skipAhead && playMonomorphic(group, playRng, reproduceRng, options.params)) {
+        return;
+    }
+    {
+        EVOSIM_TIME_PHASE(TracePhase::Play);
+        playWithinGroup(group, playRng);
+    }
+    EVOSIM_TIME_PHASE(TracePhase::Reproduce);
+    haveChildren(group, reproduceRng, options.params, options.reproductionMode);
+}
+
+void playWithinPhases(CountGroup& group, RandomStream& playRng, RandomStream& reproduceRng, const RunOptions& options) {
+    {
+        EVOSIM_TIME_PHASE(TracePhase::Play);
+        playWithinGroup(group, playRng);
+    }
+    EVOSIM_TIME_PHASE(TracePhase::Reproduce);
+    haveChildren(group, reproduceRng, options.params);
+}
+
+/*
+Within-group phases. Groups don't touch each other here and each has its own streams, so they can go to any
+thread in any order and the result is the same. world holds groups firstId, firstId + 1, ... of the whole
+world (all of it, except in a sharded run).
+*/
+template <typename GroupType>
+void playWithinAll(std::vector<GroupType>& world, size_t firstId, int j, const RunOptions& options, ThreadPool& pool,
+                   WorldStatistics& statistics) {
+    EVOSIM_TIME_PHASE(TracePhase::WithinGroup);
+    pool.parallelFor(world.size(), [&](size_t k) {
+        RandomStream playRng (options.seed, j, firstId + k, Phase::Play);
+        RandomStream reproduceRng (options.seed, j, firstId + k, Phase::Reproduce);
+        playWithinPhases(world[k], playRng, reproduceRng, options);
+        statistics.collect(world[k], k);
+    });
+}
+
+/*
+The war's line-up. Shuffle the groups' indices (the groups themselves stay where they are, so the within-group
+phase keeps walking memory in the same order) and the first warSize of them fight in pairs. Returns the
+number of pairs; pair p is order[2p] against order[2p + 1].
+*/
+size_t drawWar(std::span<std::uint32_t> order, std::uint64_t seed, int j, float conflictChance) {
+    EVOSIM_TIME_PHASE(TracePhase::Shuffle);
+    RandomStream warRng (seed, j, 0, Phase::War);
+    int numGroups ((int) order.size());
+    std::iota(order.begin(), order.end(), 0u);
+    shuffleRange(order.data(), order.size(), warRng);
+    std::binomial_distribution<> war (numGroups, conflictChance);
+    int warSize = war(warRng);
+
+    if (warSize % 2 != 0) {
+        ++warSize;
+    }
+    return (size_t) (std::min(warSize, numGroups) / 2);
+}
+
+/*
+The war on a topology. Each group starts a conflict with chance conflictChance / 2 and picks one of its
+neighbours at random, out of those not already fighting this generation; so about as many groups fight as
+without a topology (a few fewer, when a group is already taken or all its neighbours are). The starters are
+drawn in group order with geometric jumps from one to the next rather than a shuffle of the whole world, so
+the pairs come out in memory order, each close to its neighbour. Pairs go into order (pair p is order[2p]
+against order[2p + 1]) and engaged is scratch space, a byte per group.
+*/
+size_t drawNeighbourWar(std::span<std::uint32_t> order, std::span<std::uint8_t> engaged, const Topology& topology,
+                        std::uint64_t seed, int j, float conflictChance) {
+    EVOSIM_TIME_PHASE(TracePhase::Shuffle);
+    RandomStream warRng (seed, j, 0, Phase::War);
+    std::fill(engaged.begin(), engaged.end(), 0);
+    double startChance (std::clamp((double) conflictChance / 2, 0.0, 1.0));
+    if (startChance <= 0) {
+        return 0;
+    }
+    double logNoStart (std::log1p(-startChance));
+    size_t numGroups (engaged.size());
+    size_t numPairs (0);
+    size_t g (0);
+    while (true) {
+        if (startChance < 1) {
+            double u ((warRng() + 0.5) * 0x1p-32); //on (0, 1)
+            double gap (std::floor(std::log(u) / logNoStart));
+            if (!(gap < (double) (numGroups - g))) {
+                break;
+            }
+            g += (size_t) gap;
+        }
+        else if (g >= numGroups) {
+            break;
+        }
+        if (engaged[g] == 0) {
+            //count the free neighbours, then take a random one of them
+            std::span<const std::uint32_t> around = topology.neighboursOf(g);
+            std::uint32_t numFree (0);
+            for (std::uint32_t n : around) {
+                numFree += engaged[n] == 0 ? 1 : 0;
+            }
+            if (numFree > 0) {
+                std::uint32_t pick (warRng.below(numFree));
+                std::uint32_t partner (0);
+                for (std::uint32_t n : around) {
+                    if (engaged[n] == 0 && pick-- == 0) {
+                        partner = n;
+                        break;
+                    }
+                }
+                engaged[g] = 1;
+                engaged[partner] = 1;
+                order[2 * numPairs] = (std::uint32_t) g;
+                order[2 * numPairs + 1] = partner;
+                ++numPairs;
+            }
+        }
+        ++g;
+    }
+    return numPairs;
+}
+
+//who won each of a generation's conflicts, by pair, for the history file
+struct ConflictLog {
+    std::vector<std::uint32_t> winners;
+    std::vector<std::uint32_t> losers;
+};
+
+template <typename GroupType>
+WorldStats runGeneration(std::vector<GroupType>& world, int j, float conflictChance, const RunOptions& options, ThreadPool& pool,
+                         WorldStatistics& statistics, ConflictLog* conflicts = nullptr) {
+    playWithinAll(world, 0, j, options, pool, statistics);
+
+    //the pairs are disjoint and each has its own stream, so they all fight at once
+    ArenaScope scratch (threadArena());
+    std::span<std::uint32_t> order = scratch.allocate<std::uint32_t>(world.size());
+    size_t numPairs;
+    if (options.topology != nullptr) {
+        numPairs = drawNeighbourWar(order, scratch.allocate<std::uint8_t>(world.size()), *options.topology, options.seed, j, conflictChance);
+    }
+    else {
+        numPairs = drawWar(order, options.seed, j, conflictChance);
+    }
+    if (conflicts != nullptr) {
+        conflicts->winners.resize(numPairs);
+        conflicts->losers.resize(numPairs);
+    }
+    {
+        EVOSIM_TIME_PHASE(TracePhase::War);
+        pool.parallelFor(numPairs, [&](size_t pair) {
+            RandomStream conflictRng (options.seed, j, pair, Phase::Conflict);
+            if (conflicts != nullptr) {
+                //the same rule playGroupGame goes by, ties to the first
+                bool firstWins (world[order[2 * pair]].getTotalPayoff() >= world[order[2 * pair + 1]].getTotalPayoff());
+                conflicts->winners[pair] = order[2 * pair + (firstWins ? 0 : 1)];
+                conflicts->losers[pair] = order[2 * pair + (firstWins ? 1 : 0)];
+            }
+            playGroupGame(world[order[2 * pair]], world[order[2 * pair + 1]], conflictRng);
+            statistics.collect(world[order[2 * pair]], order[2 * pair]);
+            statistics.collect(world[order[2 * pair + 1]], order[2 * pair + 1]);
+        });
+    }
+
+    EVOSIM_TIME_PHASE(TracePhase::Statistics);
+    statistics.update(world);
+    return statistics.summary();
+}
+
+/*
+Trajectory output. The generation loop fills in a GenerationRecord (world averages and, if asked for, every
+group's state) and hands it to a TrajectoryWriter, which formats and writes it on its own thread. Records go
+through a bounded queue of preallocated slots, so a slow disk makes the simulation wait instead of eating
+memory, and a fast one costs the simulation almost nothing. (In a sweep the jobs are already parallel, so there
+the writer writes synchronously.)
+
+Two outputs, either optional: the familiar world-level CSV, and a binary trajectory file. The binary file is
+columnar: a header, then blocks of up to TRAJECTORY_BLOCK generations, each holding one column after the
+other (generation numbers, the four world averages, then each per-group field for every generation and group).
+--export-csv turns a trajectory file back into the CSV.
+
+    header: "EVOTRAJ\0", u32 version, u32 byte-order mark 0x01020304, u32 groups, u32 flags (1 = group states),
+            u32 generations per block
+    block:  u32 "BLK\0", u32 generations in this block (k), then
+            i32 generation[k], f32 pCoop[k], f32 avgTRate[k], f32 avgSRate[k], f32 conflictChance[k],
+            and with group states, for each of f32 propCoop, f32 taxRate, f32 segRate, u32 size, f32 totalPayoff:
+            [k][groups] values indexed by group id
+*/
+
+const char* CSV_HEADER = "Time,Proportion of Cooperators,Average Tax Rate,Average Segmentation Rate,Conflict Chance";
+const char TRAJECTORY_MAGIC[8] = {'E', 'V', 'O', 'T', 'R', 'A', 'J', '\0'};
+const std::uint32_t TRAJECTORY_VERSION = 1;
+const std::uint32_t TRAJECTORY_BYTE_ORDER = 0x01020304;
+const std::uint32_t TRAJECTORY_BLOCK_MAGIC = 0x004B4C42; //"BLK\0" read little-endian
+const std::uint32_t TRAJECTORY_BLOCK = 256;
+
+struct GenerationRecord {
+    int generation = 0; //first generation of the window, when averaging over windows
+    WorldStats stats;
+    float conflictChance = 0;
+    WorldDistribution distribution; //written only with --distributions; the last generation's, when averaging over windows
+    std::uint32_t window = 1; //generations averaged into this record
+    WorldStats spread; //standard deviations over the window
+    float conflictSpread = 0;
+    //per-group state, indexed by group id; empty unless the writer records group states
+    std::vector<float> propCoop;
+    std::vector<float> taxRate;
+    std::vector<float> segRate;
+    std::vector<std::uint32_t> size;
+    std::vector<float> totalPayoff;
+};
+
+/*
+Running mean and spread of the world averages over an output window (--output-window), by Welford's method,
+so a window of any length costs the same four numbers. Plain data so that a checkpoint can store it.
+*/
+struct WindowStats {
+    std::uint64_t count = 0;
+    std::int64_t first = 0; //generation the window started at
+    double mean[4] = {};
+    double m2[4] = {};
+
+    void add(int generation, const WorldStats& stats, float conflictChance) {
+        if (count == 0) {
+            first = generation;
+        }
+        double values[4] = {stats.pCoop, stats.avgTRate, stats.avgSRate, conflictChance};
+        ++count;
+        for (int v (0); v < 4; ++v) {
+            double delta (values[v] - mean[v]);
+            mean[v] += delta / (double) count;
+            m2[v] += delta * (values[v] - mean[v]);
+        }
+    }
+
+    //fills in the record's averages and spreads and starts a new window
+    void finish(GenerationRecord& record) {
+        double sd[4];
+        for (int v (0); v < 4; ++v) {
+            sd[v] = count > 1 ? std::sqrt(m2[v] / (double) (count - 1)) : 0;
+        }
+        record.generation = (int) first;
+        record.window = (std::uint32_t) count;
+        record.stats = WorldStats {(float) mean[0], (float) mean[1], (float) mean[2]};
+        record.conflictChance = (float) mean[3];
+        record.spread = WorldStats {(float) sd[0], (float) sd[1], (float) sd[2]};
+        record.conflictSpread = (float) sd[3];
+        *this = WindowStats();
+    }
+};
+
+/*
+Stopping a run once its long-run cooperation is known well enough (--precision). The estimate is the mean
+Proportion of Cooperators over the second half of the run so far (the first half is burn-in while the conflict
+chance and the world settle down), and its confidence interval comes from batch means: consecutive generations
+are strongly correlated, but the means of long enough batches of them are nearly independent, so their spread
+gives an honest interval. Batches start BATCH_LENGTH generations long, and whenever there are MAX_BATCHES of
+them neighbours are merged and the length doubles, so the batches grow with the run at a fixed cost.
+
+The run stops when the 95% interval is within +/- precision and the kept batches look stationary: the means of
+their two halves agree to within two standard errors, and neighbouring batch means are barely correlated (if
+they are, the batches are still too short and the interval too narrow). Neither can see a change of regime that
+hasn't happened yet, and with the default parameters a world can sit near all-defect for up to two thousand
+generations before cooperation takes off, so nothing stops before minGenerations (--min-generations, default
+2500). The exception is when cooperation can't move any more: without mutation, a world with no cooperators
+left (or nobody else) stays that way, and the run stops there.
+*/
+enum class StopReason {
+    Limit, //ran every generation
+    Converged,
+    Absorbed
+};
+
+const char* STOP_REASON_NAMES[3] = {"limit", "converged", "absorbed"};
+
+class ConvergenceMonitor {
+public:
+    ConvergenceMonitor(double precision, float mutationRate, int minGenerations)
+        : precision(precision), mutationRate(mutationRate), minGenerations(minGenerations) {
+        batches.reserve(MAX_BATCHES);
+    }
+
+    //takes the next generation's averages, and returns true if the run can stop there
+    bool add(const WorldStats& stats) {
+        ++generations;
+        if (mutationRate == 0 && (stats.pCoop <= 0 || stats.pCoop >= 1)) {
+            reason = StopReason::Absorbed;
+            estimate = stats.pCoop;
+            halfWidth = 0;
+            return true;
+        }
+        batchSum += stats.pCoop;
+        if (++inBatch < batchLength) {
+            return false;
+        }
+        batches.push_back(batchSum / (double) batchLength);
+        batchSum = 0;
+        inBatch = 0;
+        if (batches.size() == MAX_BATCHES) {
+            for (size_t b (0); b < MAX_BATCHES / 2; ++b) {
+                batches[b] = 0.5 * (batches[2 * b] + batches[2 * b + 1]);
+            }
+            batches.resize(MAX_BATCHES / 2);
+            batchLength *= 2;
+        }
+        if (evaluate() && generations >= minGenerations) {
+            reason = StopReason::Converged;
+            return true;
+        }
+        return false;
+    }
+
+    StopReason getReason() const {
+        return reason;
+    }
+
+    int getGenerations() const {
+        return generations;
+    }
+
+    //the latest estimate and its interval's half-width; NaN until there are enough batches
+    double getEstimate() const {
+        return estimate;
+    }
+
+    double getHalfWidth() const {
+        return halfWidth;
+    }
+
+private:
+    static const size_t BATCH_LENGTH = 10;
+    static const size_t MAX_BATCHES = 64;
+    static const size_t MIN_BATCHES = 10; //kept after the burn-in, before anything is estimated
+
+    static constexpr double MAX_CORRELATION = 0.3; //lag-1, between kept batch means
+
+    double precision;
+    float mutationRate;
+    int minGenerations;
+    std::vector<double> batches; //means of the finished batches
+    size_t batchLength = BATCH_LENGTH;
+    size_t inBatch = 0;
+    double batchSum = 0;
+    int generations = 0;
+    StopReason reason = StopReason::Limit;
+    double estimate = std::numeric_limits<double>::quiet_NaN();
+    double halfWidth = std::numeric_limits<double>::quiet_NaN();
+
+    //the 97.5% point of Student's t, by its Cornish-Fisher expansion about the normal's (good to 1e-3 from 9 dof)
+    static double tQuantile(double dof) {
+        const double z (1.959964);
+        return z + (z * z * z + z) / (4 * dof) + (5 * std::pow(z, 5) + 16 * z * z * z + 3 * z) / (96 * dof * dof);
+    }
+
+    bool evaluate() {
+        size_t first (batches.size() / 2);
+        size_t kept (batches.size() - first);
+        if (kept < MIN_BATCHES) {
+            return false;
+        }
+        double mean (0);
+        for (size_t b (first); b < batches.size(); ++b) {
+            mean += batches[b] / (double) kept;
+        }
+        double variance (0);
+        for (size_t b (first); b < batches.size(); ++b) {
+            variance += (batches[b] - mean) * (batches[b] - mean) / (double) (kept - 1);
+        }
+        estimate = mean;
+        halfWidth = tQuantile((double) (kept - 1)) * std::sqrt(variance / (double) kept);
+
+        size_t middle (first + kept / 2);
+        double early (0), late (0);
+        for (size_t b (first); b < batches.size(); ++b) {
+            (b < middle ? early : late) += batches[b];
+        }
+        early /= (double) (middle - first);
+        late /= (double) (batches.size() - middle);
+        double drift (2 * std::sqrt(variance * (1.0 / (double) (middle - first) + 1.0 / (double) (batches.size() - middle))));
+
+        double lagged (0);
+        for (size_t b (first + 1); b < batches.size(); ++b) {
+            lagged += (batches[b] - mean) * (batches[b - 1] - mean);
+        }
+        double correlation (variance > 0 ? lagged / (variance * (double) (kept - 1)) : 0);
+        return halfWidth <= precision && std::abs(early - late) <= drift && correlation <= MAX_CORRELATION;
+    }
+};
+
+/*
+A sweep's cores, shared out between the jobs still running. While there are jobs waiting, every job runs on the
+one core it started on; once they run out, each core left idle goes to the jobs still running, which grow their
+pools to their share at the next generation. Results don't depend on the thread count, so that changes nothing
+but how soon the last jobs finish.
+*/
+class CoreShare {
+public:
+    explicit CoreShare(unsigned cores) : cores(cores), running(cores) {}
+
+    //one of the cores found no more jobs to start
+    void release() {
+        running.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    unsigned share() const {
+        return std::max(1u, cores / std::max(1u, running.load(std::memory_order_relaxed)));
+    }
+
+private:
+    unsigned cores;
+    std::atomic<unsigned> running;
+};
+
+class HistoryRecorder;
+
+//what runSimulation can be asked to do besides playing every generation
+struct RunControl {
+    ConvergenceMonitor* monitor = nullptr; //stop once this says so
+    const CoreShare* cores = nullptr; //grow the run's pool when more cores come free
+    HistoryRecorder* history = nullptr; //record every generation's changes to this
+};
+
+const char* CSV_WINDOW_COLUMNS = ",Window,SD Proportion of Cooperators,SD Average Tax Rate,SD Average Segmentation Rate,SD Conflict Chance";
+
+//the agent-weighted cooperation, the size quantiles, then a column of group counts per (tax, seg) cell
+void writeDistributionColumns(std::ostream& out) {
+    out << ",Agent Proportion of Cooperators,Min Group Size,P10 Group Size,Median Group Size,P90 Group Size,Max Group Size";
+    for (int t (0); t < TAX_BINS; ++t) {
+        for (int s (0); s < SEG_BINS; ++s) {
+            out << ",Groups T" << t / 10 << "." << t % 10 << " S0." << s;
+        }
+    }
+}
+
+class TrajectoryWriter {
+public:
+    //either path can be empty to skip that output
+    //append carries on files left by an earlier run (when resuming from a checkpoint) instead of starting them
+    //windowed adds the window length and spreads to the CSV (the binary file just has the averages), and
+    //distributions the columns of WorldDistribution
+    TrajectoryWriter(const std::string& csvPath, const std::string& binaryPath, size_t numGroups, bool groupStates, bool async,
+                     bool append = false, bool windowed = false, bool distributions = false)
+        : groups(numGroups), recordGroups(groupStates && !binaryPath.empty()), windowed(windowed), distributions(distributions),
+          csvFile(csvPath), binaryFile(binaryPath) {
+        if (!csvPath.empty()) {
+            csv.rdbuf()->pubsetbuf(csvBuffer, sizeof(csvBuffer));
+            csv.open(csvPath, append ? std::ios::app : std::ios::out);
+            good = good && (bool) csv;
+            if (!append) {
+                csv << CSV_HEADER << (windowed ? CSV_WINDOW_COLUMNS : "");
+                if (distributions) {
+                    writeDistributionColumns(csv);
+                }
+                csv << "\n";
+            }
+        }
+        if (!binaryPath.empty()) {
+            binary.open(binaryPath, append ? std::ios::binary | std::ios::app : std::ios::binary);
+            good = good && (bool) binary;
+        }
+        if (!binaryPath.empty() && !append) {
+            std::uint32_t header[4] = {TRAJECTORY_VERSION, TRAJECTORY_BYTE_ORDER, (std::uint32_t) groups, recordGroups ? 1u : 0u};
+            binary.write(TRAJECTORY_MAGIC, sizeof(TRAJECTORY_MAGIC));
+            binary.write(reinterpret_cast<const char*>(header), sizeof(header));
+            binary.write(reinterpret_cast<const char*>(&TRAJECTORY_BLOCK), sizeof(TRAJECTORY_BLOCK));
+        }
+        if (!binaryPath.empty()) {
+            block.resize(TRAJECTORY_BLOCK);
+            for (GenerationRecord& record : block) {
+                sizeRecord(record);
+            }
+        }
+
+        slots.resize(async ? QUEUE_DEPTH : 1);
+        for (GenerationRecord& slot : slots) {
+            sizeRecord(slot);
+        }
+        if (async) {
+            writerThread = std::thread([this] { writerLoop(); });
+        }
+    }
+
+    ~TrajectoryWriter() {
+        close();
+    }
+
+    TrajectoryWriter(const TrajectoryWriter&) = delete;
+    TrajectoryWriter& operator= (const TrajectoryWriter&) = delete;
+
+    bool ok() const {
+        return good;
+    }
+
+    bool wantsGroupStates() const {
+        return recordGroups;
+    }
+
+    //a free slot to fill in, waiting for the writer if the queue is full
+    GenerationRecord& beginRecord() {
+        std::unique_lock<std::mutex> lock (queueMutex);
+        slotFree.wait(lock, [this] { return produced - consumed < slots.size(); });
+        return slots[produced % slots.size()];
+    }
+
+    void commitRecord() {
+        if (!writerThread.joinable()) {
+            write(slots[produced % slots.size()]);
+            ++produced;
+            ++consumed;
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock (queueMutex);
+            ++produced;
+        }
+        slotFilled.notify_one();
+    }
+
+    /*
+    Waits for everything queued so far to be written, ends the current block early, and flushes both files, so
+    that what's on disk is exactly the output up to now. Reports how long each file is at that point (0 if it
+    isn't being written) for a checkpoint to record.
+    */
+    void sync(std::uint64_t& csvBytes, std::uint64_t& binaryBytes) {
+        {
+            std::unique_lock<std::mutex> lock (queueMutex);
+            slotFree.wait(lock, [this] { return produced == consumed; });
+        }
+        flushBlock();
+        csvBytes = 0;
+        binaryBytes = 0;
+        if (csv.is_open()) {
+            csv.flush();
+            csvBytes = std::filesystem::file_size(csvFile);
+        }
+        if (binary.is_open()) {
+            binary.flush();
+            binaryBytes = std::filesystem::file_size(binaryFile);
+        }
+        good = good && (!csv.is_open() || (bool) csv) && (!binary.is_open() || (bool) binary);
+    }
+
+    //writes out whatever is queued and the last partial block
+    void close() {
+        if (closed) {
+            return;
+        }
+        closed = true;
+        if (writerThread.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock (queueMutex);
+                finishing = true;
+            }
+            slotFilled.notify_one();
+            writerThread.join();
+        }
+        flushBlock();
+        //closing flushes, so a full disk can still turn up here
+        if (csv.is_open()) {
+            csv.close();
+            good = good && (bool) csv;
+        }
+        if (binary.is_open()) {
+            binary.close();
+            good = good && (bool) binary;
+        }
+    }
+
+private:
+    static const size_t QUEUE_DEPTH = 64;
+
+    size_t groups;
+    bool recordGroups;
+    bool good = true;
+    bool closed = false;
+    bool windowed;
+    bool distributions;
+    std::string csvFile;
+    std::string binaryFile;
+    std::ofstream csv;
+    char csvBuffer[1 << 16];
+    std::ofstream binary;
+    std::vector<GenerationRecord> block; //the generations of the block being assembled
+    size_t blockCount = 0;
+
+    std::vector<GenerationRecord> slots;
+    std::uint64_t produced = 0;
+    std::uint64_t consumed = 0;
+    bool finishing = false;
+    std::mutex queueMutex;
+    std::condition_variable slotFree;
+    std::condition_variable slotFilled;
+    std::thread writerThread;
+
+    void sizeRecord(GenerationRecord& record) const {
+        if (recordGroups) {
+            record.propCoop.resize(groups);
+            record.taxRate.resize(groups);
+            record.segRate.resize(groups);
+            record.size.resize(groups);
+            record.totalPayoff.resize(groups);
+        }
+    }
+
+    void writerLoop() {
+        while (true) {
+            GenerationRecord* record;
+            {
+                std::unique_lock<std::mutex> lock (queueMutex);
+                slotFilled.wait(lock, [this] { return produced > consumed || finishing; });
+                if (produced == consumed) {
+                    return; //finishing and nothing left
+                }
+                record = &slots[consumed % slots.size()];
+            }
+            write(*record);
+            {
+                std::lock_guard<std::mutex> lock (queueMutex);
+                ++consumed;
+            }
+            slotFree.notify_all(); //the producer may be waiting for a slot or for the queue to drain
+        }
+    }
+
+    void write(const GenerationRecord& record) {
+        if (csv.is_open()) {
+            csv << record.generation << "," << record.stats.pCoop << "," << record.stats.avgTRate << ","
+                << record.stats.avgSRate << "," << record.conflictChance;
+            if (windowed) {
+                csv << "," << record.window << "," << record.spread.pCoop << "," << record.spread.avgTRate << ","
+                    << record.spread.avgSRate << "," << record.conflictSpread;
+            }
+            if (distributions) {
+                const WorldDistribution& d = record.distribution;
+                csv << "," << d.agentCoop;
+                for (std::uint32_t size : d.sizeQuantiles) {
+                    csv << "," << size;
+                }
+                for (std::uint32_t count : d.institutions) {
+                    csv << "," << count;
+                }
+            }
+            csv << "\n";
+        }
+        if (binary.is_open()) {
+            //records are all the same size, so copying one into the block never allocates
+            block[blockCount++] = record;
+            if (blockCount == TRAJECTORY_BLOCK) {
+                flushBlock();
+            }
+        }
+    }
+
+    template <typename T, typename Field>
+    void writeColumn(Field field) {
+        for (size_t g (0); g < blockCount; ++g) {
+            T value = field(block[g]);
+            binary.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+    }
+
+    template <typename T>
+    void writeGroupColumn(std::vector<T> GenerationRecord::* field) {
+        for (size_t g (0); g < blockCount; ++g) {
+            binary.write(reinterpret_cast<const char*>((block[g].*field).data()), sizeof(T) * groups);
+        }
+    }
+
+    void flushBlock() {
+        if (!binary.is_open() || blockCount == 0) {
+            return;
+        }
+        std::uint32_t header[2] = {TRAJECTORY_BLOCK_MAGIC, (std::uint32_t) blockCount};
+        binary.write(reinterpret_cast<const char*>(header), sizeof(header));
+        writeColumn<std::int32_t>([](const GenerationRecord& r) { return (std::int32_t) r.generation; });
+        writeColumn<float>([](const GenerationRecord& r) { return r.stats.pCoop; });
+        writeColumn<float>([](const GenerationRecord& r) { return r.stats.avgTRate; });
+        writeColumn<float>([](const GenerationRecord& r) { return r.stats.avgSRate; });
+        writeColumn<float>([](const GenerationRecord& r) { return r.conflictChance; });
+        if (recordGroups) {
+            writeGroupColumn(&GenerationRecord::propCoop);
+            writeGroupColumn(&GenerationRecord::taxRate);
+            writeGroupColumn(&GenerationRecord::segRate);
+            writeGroupColumn(&GenerationRecord::size);
+            writeGroupColumn(&GenerationRecord::totalPayoff);
+        }
+        good = good && (bool) binary;
+        blockCount = 0;
+    }
+};
+
+template <typename GroupType>
+void fillRecord(GenerationRecord& record, const std::vector<GroupType>& world, bool groupStates) {
+    if (!groupStates) {
+        return;
+    }
+    for (const GroupType& group : world) {
+        record.propCoop[group.id] = group.getPropCoop();
+        record.taxRate[group.id] = group.getTaxRate();
+        record.segRate[group.id] = group.getSegRate();
+        record.size[group.id] = (std::uint32_t) group.getSize();
+        record.totalPayoff[group.id] = group.getTotalPayoff();
+    }
+}
+
+//the world-level CSV of a binary trajectory file
+bool exportTrajectoryCsv(const std::string& binaryPath, const std::string& csvPath) {
+    std::ifstream in (binaryPath, std::ios::binary);
+    char magic[8];
+    std::uint32_t header[5];
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!in || std::memcmp(magic, TRAJECTORY_MAGIC, sizeof(magic)) != 0 || header[0] != TRAJECTORY_VERSION
+        || header[1] != TRAJECTORY_BYTE_ORDER) {
+        std::cerr << binaryPath << " isn't a trajectory file this version can read\n";
+        return false;
+    }
+    std::uint32_t numGroups (header[2]);
+    bool groupStates (header[3] & 1u);
+
+    std::ofstream out (csvPath);
+    if (!out) {
+        std::cerr << "Couldn't write " << csvPath << "\n";
+        return false;
+    }
+    out << CSV_HEADER << "\n";
+
+    std::uint32_t blockHeader[2];
+    std::vector<std::int32_t> generation;
+    std::vector<float> columns;
+    while (in.read(reinterpret_cast<char*>(blockHeader), sizeof(blockHeader))) {
+        if (blockHeader[0] != TRAJECTORY_BLOCK_MAGIC) {
+            std::cerr << binaryPath << " is corrupt\n";
+            return false;
+        }
+        std::uint32_t k (blockHeader[1]);
+        generation.resize(k);
+        columns.resize(4 * (size_t) k);
+        in.read(reinterpret_cast<char*>(generation.data()), sizeof(std::int32_t) * k);
+        in.read(reinterpret_cast<char*>(columns.data()), sizeof(float) * 4 * k);
+        if (groupStates) {
+            in.seekg((std::streamoff) 5 * 4 * k * numGroups, std::ios::cur); //five 4-byte group columns
+        }
+        if (!in) {
+            std::cerr << binaryPath << " is truncated\n";
+            return false;
+        }
+        for (std::uint32_t g (0); g < k; ++g) {
+            out << generation[g] << "," << columns[g] << "," << columns[k + g] << "," << columns[2 * k + g] << ","
+                << columns[3 * k + g] << "\n";
+        }
+    }
+    return true;
+}
+
+/*
+Checkpoints. Every --checkpoint-every generations the whole world is written to a snapshot file, and
+--resume picks a run up from one. The random streams are counter-based, so "where the RNG is" is just the
+seed and the generation number; the conflict chance series is a function of the seed and run length, so it is
+recomputed on resume (the snapshot keeps the next value to check against). Resuming from generation g gives
+exactly the run that would have happened without the interruption, for any thread count.
+
+The snapshot is laid out so it can be memory-mapped and read in place: a fixed header, a table of
+SnapshotGroup records, then the members of every group as packed trait words followed by payoffs (per-agent
+engine only), all 8-byte aligned and in native byte order. It is written to FILE.tmp and renamed over FILE,
+so a run killed mid-checkpoint still has the previous one. The header also records how long the output files
+were at the checkpoint, so a resumed run cuts off anything written after it and carries on from there.
+*/
+
+const char SNAPSHOT_MAGIC[8] = {'E', 'V', 'O', 'S', 'N', 'A', 'P', '\0'};
+const std::uint32_t SNAPSHOT_VERSION = 5;
+
+struct SnapshotHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder; //TRAJECTORY_BYTE_ORDER as written by the machine that wrote it
+    std::uint64_t seed;
+    std::int64_t nextGeneration; //the first generation a resumed run plays
+    std::int64_t iterations;
+    std::uint32_t countEngine;
+    std::uint32_t reproductionMode;
+    float groupConflictChance;
+    float individualMutationRate;
+    float institutionalChangeChance;
+    std::int32_t initialGroups;
+    std::int32_t agentsMultiplier;
+    std::uint32_t groupStates; //whether the trajectory file records group states
+    float nextConflictChance; //for checking the recomputed series
+    std::uint32_t numGroups;
+    std::uint64_t csvBytes;
+    std::uint64_t trajectoryBytes;
+    std::uint64_t groupTableOffset;
+    std::uint64_t memberOffset;
+    std::uint64_t fileSize;
+    std::uint32_t streaming; //conflict chance made as the run goes
+    float conflictDeviation; //and where it had got to
+    std::int32_t outputEvery;
+    std::int32_t outputWindow;
+    WindowStats window; //the output window in progress
+    std::uint32_t game; //GameKind
+    std::uint32_t skipAhead;
+    std::uint32_t distributions; //whether the CSV has the distribution columns
+    std::uint32_t padding;
+};
+
+struct SnapshotGroup {
+    std::uint32_t id;
+    float proportionCooperative;
+    float taxRate;
+    float segmentationRate;
+    float totalPayoff;
+    std::uint32_t padding;
+    std::uint64_t size;
+    std::int64_t numCooperators; //count engine
+    std::int64_t numDefectors;
+    double cooperatorPayoff;
+    double defectorPayoff;
+    std::uint64_t wordOffset; //per-agent engine: where this group's trait words and payoffs start
+    std::uint64_t payoffOffset;
+};
+
+static_assert(sizeof(SnapshotHeader) % 8 == 0 && sizeof(SnapshotGroup) % 8 == 0, "snapshot records must stay 8-byte aligned");
+
+template <typename Game>
+size_t snapshotMemberBytes(const BasicGroup<Game>& group) {
+    size_t n (group.getSize());
+    return Population<Game>::wordsFor(n) * sizeof(std::uint64_t) + (n * sizeof(float) + 7) / 8 * 8;
+}
+
+size_t snapshotMemberBytes(const CountGroup&) {
+    return 0;
+}
+
+template <typename Game>
+void saveGroup(const BasicGroup<Game>& group, SnapshotGroup& record, std::ostream& members, std::uint64_t& offset) {
+    record.proportionCooperative = group.proportionCooperative;
+    record.taxRate = group.taxRate;
+    record.segmentationRate = group.segmentationRate;
+    record.totalPayoff = group.totalPayoff;
+    record.size = group.getSize();
+
+    std::span<const std::uint64_t> words = group.getAgents().traitWords();
+    std::span<const float> payoffs = group.getAgents().payoffs();
+    size_t numWords (Population<Game>::wordsFor(group.getSize()));
+    record.wordOffset = offset;
+    members.write(reinterpret_cast<const char*>(words.data()), numWords * sizeof(std::uint64_t));
+    offset += numWords * sizeof(std::uint64_t);
+    record.payoffOffset = offset;
+    members.write(reinterpret_cast<const char*>(payoffs.data()), payoffs.size() * sizeof(float));
+    size_t padded ((payoffs.size() * sizeof(float) + 7) / 8 * 8);
+    const char zeros[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    members.write(zeros, padded - payoffs.size() * sizeof(float));
+    offset += padded;
+}
+
+void saveGroup(const CountGroup& group, SnapshotGroup& record, std::ostream&, std::uint64_t&) {
+    record.proportionCooperative = group.proportionCooperative;
+    record.taxRate = group.taxRate;
+    record.segmentationRate = group.segmentationRate;
+    record.totalPayoff = group.totalPayoff;
+    record.size = group.getSize();
+    record.numCooperators = group.numCooperators;
+    record.numDefectors = group.numDefectors;
+    record.cooperatorPayoff = group.cooperatorPayoff;
+    record.defectorPayoff = group.defectorPayoff;
+}
+
+template <typename Game>
+void loadGroup(BasicGroup<Game>& group, const SnapshotGroup& record, const std::byte* file) {
+    group.setInstitutions(record.taxRate, record.segmentationRate);
+    group.agents.assign(reinterpret_cast<const std::uint64_t*>(file + record.wordOffset),
+                        reinterpret_cast<const float*>(file + record.payoffOffset), record.size);
+    group.updateComposition();
+    group.proportionCooperative = record.proportionCooperative;
+    group.totalPayoff = record.totalPayoff;
+}
+
+void loadGroup(CountGroup& group, const SnapshotGroup& record, const std::byte*) {
+    group.setInstitutions(record.taxRate, record.segmentationRate);
+    group.setCounts(record.numCooperators, record.numDefectors);
+    group.proportionCooperative = record.proportionCooperative;
+    group.totalPayoff = record.totalPayoff;
+    group.cooperatorPayoff = record.cooperatorPayoff;
+    group.defectorPayoff = record.defectorPayoff;
+}
+
+template <typename GroupType>
+bool writeSnapshot(const std::string& path, SnapshotHeader header, const std::vector<GroupType>& world) {
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = TRAJECTORY_BYTE_ORDER;
+    header.numGroups = (std::uint32_t) world.size();
+    header.groupTableOffset = sizeof(SnapshotHeader);
+    header.memberOffset = header.groupTableOffset + world.size() * sizeof(SnapshotGroup);
+
+    //the member block is written after the table, so lay out the table first
+    std::vector<SnapshotGroup> table (world.size());
+    std::uint64_t memberBytes (0);
+    for (const GroupType& group : world) {
+        memberBytes += snapshotMemberBytes(group);
+    }
+    header.fileSize = header.memberOffset + memberBytes;
+
+    std::string temporary (path + ".tmp");
+    {
+        std::ofstream out (temporary, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.seekp((std::streamoff) header.memberOffset);
+        std::uint64_t offset (header.memberOffset);
+        for (size_t g (0); g < world.size(); ++g) {
+            table[g] = SnapshotGroup {};
+            table[g].id = world[g].id;
+            saveGroup(world[g], table[g], out, offset);
+        }
+        out.seekp((std::streamoff) header.groupTableOffset);
+        out.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(SnapshotGroup));
+        out.flush();
+        if (!out) {
+            std::cerr << "Couldn't write checkpoint " << temporary << "\n";
+            return false;
+        }
+    }
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+    if (error) {
+        std::cerr << "Couldn't move checkpoint into place at " << path << ": " << error.message() << "\n";
+        return false;
+    }
+    return true;
+}
+
+//a snapshot file mapped read-only into memory
+class SnapshotFile {
+public:
+    explicit SnapshotFile(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            problem = "couldn't open it";
+            return;
+        }
+        struct stat info;
+        if (::fstat(fd, &info) != 0 || (size_t) info.st_size < sizeof(SnapshotHeader)) {
+            ::close(fd);
+            problem = "it's too short to be a snapshot";
+            return;
+        }
+        length = (size_t) info.st_size;
+        void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) {
+            problem = "couldn't map it";
+            return;
+        }
+        data = static_cast<const std::byte*>(mapped);
+
+        const SnapshotHeader& h = header();
+        if (std::memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+            problem = "it isn't a snapshot";
+        }
+        else if (h.version != SNAPSHOT_VERSION || h.byteOrder != TRAJECTORY_BYTE_ORDER) {
+            problem = "it was written by a different version or machine";
+        }
+        else if (h.fileSize != length || h.memberOffset > length
+                 || h.groupTableOffset + (std::uint64_t) h.numGroups * sizeof(SnapshotGroup) > h.memberOffset) {
+            problem = "it's truncated or corrupt";
+        }
+    }
+
+    ~SnapshotFile() {
+        if (data != nullptr) {
+            ::munmap(const_cast<std::byte*>(data), length);
+        }
+    }
+
+    SnapshotFile(const SnapshotFile&) = delete;
+    SnapshotFile& operator= (const SnapshotFile&) = delete;
+
+    //empty if the file is usable, otherwise what's wrong with it
+    const std::string& error() const {
+        return problem;
+    }
+
+    const SnapshotHeader& header() const {
+        return *reinterpret_cast<const SnapshotHeader*>(data);
+    }
+
+    std::span<const SnapshotGroup> groups() const {
+        return std::span<const SnapshotGroup>(reinterpret_cast<const SnapshotGroup*>(data + header().groupTableOffset),
+                                              header().numGroups);
+    }
+
+    const std::byte* bytes() const {
+        return data;
+    }
+
+private:
+    const std::byte* data = nullptr;
+    size_t length = 0;
+    std::string problem;
+};
+
+template <typename GroupType>
+std::vector<GroupType> restoreWorld(const SnapshotFile& snapshot) {
+    std::vector<GroupType> world (snapshot.groups().size());
+    for (size_t g (0); g < world.size(); ++g) {
+        const SnapshotGroup& record = snapshot.groups()[g];
+        world[g].id = record.id;
+        loadGroup(world[g], record, snapshot.bytes());
+    }
+    return world;
+}
+
+struct CheckpointOptions {
+    std::string path; //empty = no checkpoints
+    int every = 0; //generations between checkpoints
+};
+
+/*
+History files. --history run.hist records every change to every group, generation by generation, compactly
+enough to keep the whole of a very long run, and --replay rebuilds the groups as they were after any
+generation from it without running the simulation again. A group here is how many of its members play each
+strategy plus its tax and segmentation rates; payoffs come and go within a generation, so they aren't kept.
+
+Most generations change few groups, and those only a little: reproduction turns a few members from one
+strategy to another, changeInstitutions takes a step of 0.1 up or down, and a conflict hands the winner's
+institutions to the loser and splits their members between them. So each generation is a frame of differences
+from the one before: the conflicts as (winner, loser) pairs, then every group that changed as its distance from
+the last one, which institution steps it took and how far each strategy count moved, all as varints (zigzag
+for the signed ones). A loser's institutions are the winner's and aren't stored again. With the default
+parameters that comes to a couple of hundred bytes a generation, so 10^8 generations take tens of gigabytes.
+
+Frames come in blocks that each start with a keyframe of the whole world, and an index at the end of the file
+says where each block starts. Replaying generation g decodes the keyframe of the last block starting before g
+and the frames after it, at most HISTORY_KEYFRAME_SPACING keyframes' worth of bytes. The index is written when
+the run finishes; a file without it (from a run that died) is read by walking the blocks instead.
+
+    header: "EVOHIST\0", HistoryHeader
+    block:  HistoryBlockHeader (u32 "HBLK", u32 frames, u64 generations before the keyframe, u64 payload bytes),
+            then the payload:
+            keyframe: for each group, a varint per strategy count, f32 tax rate, f32 segmentation rate
+            frame:    varint conflicts, then varint winner and varint loser for each; varint changed groups,
+                      then for each, u8 code (bits 0-1 tax step and 2-3 segmentation step: 0 none, 1 +0.1,
+                      2 -0.1, 3 the new rate follows as f32; bit 4 counts follow; bits 5-7 the number of
+                      groups skipped since the last one if under 7, else 7 and a varint of the rest),
+                      [f32 tax rate], [f32 segmentation rate], [zigzag varint change per strategy count]
+    index:  u64 generations before the keyframe and u64 offset for each block; then u64 blocks,
+            u64 offset of the index, u32 "HIDX", u32 0
+*/
+
+const char HISTORY_MAGIC[8] = {'E', 'V', 'O', 'H', 'I', 'S', 'T', '\0'};
+const std::uint32_t HISTORY_VERSION = 1;
+const std::uint32_t HISTORY_BLOCK_MAGIC = 0x4B4C4248; //"HBLK" read little-endian
+const std::uint32_t HISTORY_INDEX_MAGIC = 0x58444948; //"HIDX"
+const size_t HISTORY_KEYFRAME_SPACING = 16; //a new block once the frames take this many times the keyframe
+
+struct HistoryHeader {
+    std::uint32_t version;
+    std::uint32_t byteOrder; //TRAJECTORY_BYTE_ORDER as written by the machine that wrote it
+    std::uint64_t seed;
+    std::uint32_t numGroups;
+    std::uint32_t strategies; //counts per group
+    std::uint32_t game; //GameKind
+    std::uint32_t countEngine;
+    float groupConflictChance;
+    float individualMutationRate;
+    float institutionalChangeChance;
+    std::int32_t agentsMultiplier;
+};
+
+struct HistoryBlockHeader {
+    std::uint32_t magic;
+    std::uint32_t frames;
+    std::uint64_t start; //generations played before the keyframe
+    std::uint64_t payloadBytes;
+};
+
+struct HistoryIndexEntry {
+    std::uint64_t start;
+    std::uint64_t offset;
+};
+
+//strategies a group type keeps count of: the count engine's defectors and cooperators, or the game's
+template <typename GroupType>
+constexpr int STRATEGIES_OF = 2;
+
+template <typename Game>
+constexpr int STRATEGIES_OF<BasicGroup<Game>> = Game::STRATEGIES;
+
+//the strategy counts' column names, by GameKind
+const char* STRATEGY_COLUMNS[3][3] = {{"Defectors", "Cooperators", ""}, {"Defectors", "Cooperators", "Loners"},
+                                      {"Defectors", "Cooperators", "Punishers"}};
+
+template <typename Game>
+void strategyCounts(const BasicGroup<Game>& group, std::int64_t* counts) {
+    for (int c (0); c < Game::STRATEGIES; ++c) {
+        counts[c] = (std::int64_t) group.getAgents().countStrategy((Trait) c);
+    }
+}
+
+void strategyCounts(const CountGroup& group, std::int64_t* counts) {
+    counts[DEFECT] = group.numDefectors;
+    counts[COOPERATE] = group.numCooperators;
+}
+
+void putVarint(std::vector<std::uint8_t>& out, std::uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back((std::uint8_t) (value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((std::uint8_t) value);
+}
+
+void putFloat(std::vector<std::uint8_t>& out, float value) {
+    std::uint8_t bytes[sizeof(float)];
+    std::memcpy(bytes, &value, sizeof(float));
+    out.insert(out.end(), bytes, bytes + sizeof(float));
+}
+
+std::uint64_t zigzag(std::int64_t value) {
+    return ((std::uint64_t) value << 1) ^ (std::uint64_t) (value >> 63);
+}
+
+//how a rate got from before to after: none, one of changeInstitutions' steps (done in double, as there), or neither
+int institutionStep(float before, float after) {
+    if (after == before) {
+        return 0;
+    }
+    if (after == (float) ((double) before + 0.1)) {
+        return 1;
+    }
+    if (after == (float) ((double) before - 0.1)) {
+        return 2;
+    }
+    return 3;
+}
+
+//reads a block's payload, failing (and staying failed) rather than running off the end
+struct HistoryCursor {
+    const std::uint8_t* at;
+    const std::uint8_t* end;
+    bool good = true;
+
+    std::uint64_t varint() {
+        std::uint64_t value (0);
+        for (int shift (0); shift < 64; shift += 7) {
+            if (at == end) {
+                good = false;
+                return 0;
+            }
+            std::uint8_t byte (*at++);
+            value |= (std::uint64_t) (byte & 0x7F) << shift;
+            if (byte < 0x80) {
+                return value;
+            }
+        }
+        good = false;
+        return 0;
+    }
+
+    std::int64_t signedVarint() {
+        std::uint64_t value (varint());
+        return (std::int64_t) (value >> 1) ^ -(std::int64_t) (value & 1);
+    }
+
+    std::uint8_t byte() {
+        if (at == end) {
+            good = false;
+            return 0;
+        }
+        return *at++;
+    }
+
+    float raw() {
+        float value (0);
+        if (end - at < (std::ptrdiff_t) sizeof(float)) {
+            good = false;
+            return value;
+        }
+        std::memcpy(&value, at, sizeof(float));
+        at += sizeof(float);
+        return value;
+    }
+
+    float stepped(float before, int step) {
+        switch (step) {
+            case 1: return (float) ((double) before + 0.1);
+            case 2: return (float) ((double) before - 0.1);
+            case 3: return raw();
+            default: return before;
+        }
+    }
+};
+
+/*
+Writes a history file. runSimulation calls begin() with the starting world, then record() after every
+generation, with the conflicts runGeneration wrote into conflictLog() and the groups WorldStatistics went
+through (every group that can have changed passes through there). Blocks are put together in memory and
+written whole, on the main thread between generations.
+*/
+class HistoryRecorder {
+public:
+    explicit HistoryRecorder(const std::string& path) : file(path, std::ios::binary) {}
+
+    ~HistoryRecorder() {
+        close();
+    }
+
+    HistoryRecorder(const HistoryRecorder&) = delete;
+    HistoryRecorder& operator= (const HistoryRecorder&) = delete;
+
+    bool ok() const {
+        return (bool) file;
+    }
+
+    ConflictLog& conflictLog() {
+        return conflicts;
+    }
+
+    template <typename GroupType>
+    void begin(const RunOptions& options, const std::vector<GroupType>& world) {
+        numGroups = world.size();
+        strategies = STRATEGIES_OF<GroupType>;
+        HistoryHeader header {};
+        header.version = HISTORY_VERSION;
+        header.byteOrder = TRAJECTORY_BYTE_ORDER;
+        header.seed = options.seed;
+        header.numGroups = (std::uint32_t) numGroups;
+        header.strategies = (std::uint32_t) strategies;
+        header.game = (std::uint32_t) options.game;
+        header.countEngine = std::is_same_v<GroupType, CountGroup> ? 1 : 0;
+        header.groupConflictChance = options.params.groupConflictChance;
+        header.individualMutationRate = options.params.individualMutationRate;
+        header.institutionalChangeChance = options.params.institutionalChangeChance;
+        header.agentsMultiplier = options.params.agentsMultiplier;
+        file.write(HISTORY_MAGIC, sizeof(HISTORY_MAGIC));
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        offset = sizeof(HISTORY_MAGIC) + sizeof(header);
+
+        counts.resize(numGroups * strategies);
+        taxRates.resize(numGroups);
+        segRates.resize(numGroups);
+        for (size_t g (0); g < numGroups; ++g) {
+            strategyCounts(world[g], &counts[g * strategies]);
+            taxRates[g] = world[g].getTaxRate();
+            segRates[g] = world[g].getSegRate();
+        }
+        conflicts.winners.reserve(numGroups / 2 + 1);
+        conflicts.losers.reserve(numGroups / 2 + 1);
+        lost.assign(numGroups, 0);
+        groups.reserve(2 * numGroups);
+        startBlock();
+    }
+
+    template <typename GroupType>
+    void record(const std::vector<GroupType>& world, const WorldStatistics& statistics) {
+        putVarint(block, conflicts.winners.size());
+        for (size_t c (0); c < conflicts.winners.size(); ++c) {
+            putVarint(block, conflicts.winners[c]);
+            putVarint(block, conflicts.losers[c]);
+            lost[conflicts.losers[c]] = 1;
+        }
+
+        //a group can be reported twice (after its own phases and after a conflict), so sort them out first
+        groups.assign(statistics.lastChanged().begin(), statistics.lastChanged().end());
+        std::sort(groups.begin(), groups.end());
+        groups.erase(std::unique(groups.begin(), groups.end()), groups.end());
+
+        entries.clear();
+        size_t numEntries (0);
+        std::int64_t previous (-1);
+        std::int64_t now[4];
+        for (std::uint32_t g : groups) {
+            const GroupType& group = world[g];
+            strategyCounts(group, now);
+            std::int64_t* was = &counts[(size_t) g * strategies];
+            bool moved (!std::equal(now, now + strategies, was));
+            //a loser's institutions come from the winner, which replay takes care of
+            int taxStep (lost[g] ? 0 : institutionStep(taxRates[g], group.getTaxRate()));
+            int segStep (lost[g] ? 0 : institutionStep(segRates[g], group.getSegRate()));
+            taxRates[g] = group.getTaxRate();
+            segRates[g] = group.getSegRate();
+            if (!moved && taxStep == 0 && segStep == 0) {
+                continue;
+            }
+
+            std::uint64_t gap ((std::uint64_t) ((std::int64_t) g - previous - 1));
+            previous = g;
+            ++numEntries;
+            entries.push_back((std::uint8_t) (taxStep | segStep << 2 | (moved ? 16 : 0) | std::min<std::uint64_t>(gap, 7) << 5));
+            if (gap >= 7) {
+                putVarint(entries, gap - 7);
+            }
+            if (taxStep == 3) {
+                putFloat(entries, taxRates[g]);
+            }
+            if (segStep == 3) {
+                putFloat(entries, segRates[g]);
+            }
+            if (moved) {
+                for (int c (0); c < strategies; ++c) {
+                    putVarint(entries, zigzag(now[c] - was[c]));
+                    was[c] = now[c];
+                }
+            }
+        }
+        putVarint(block, numEntries);
+        block.insert(block.end(), entries.begin(), entries.end());
+
+        for (std::uint32_t loser : conflicts.losers) {
+            lost[loser] = 0;
+        }
+        ++frames;
+        ++played;
+        if (block.size() - keyframeBytes >= HISTORY_KEYFRAME_SPACING * keyframeBytes) {
+            finishBlock();
+            startBlock();
+        }
+    }
+
+    //writes the last block and the index; returns whether everything made it to disk
+    bool close() {
+        if (!file.is_open()) {
+            return true;
+        }
+        if (frames > 0 || index.empty()) {
+            finishBlock();
+        }
+        std::uint64_t indexOffset (offset);
+        file.write(reinterpret_cast<const char*>(index.data()), index.size() * sizeof(HistoryIndexEntry));
+        std::uint64_t numBlocks (index.size());
+        std::uint32_t footer[2] = {HISTORY_INDEX_MAGIC, 0};
+        file.write(reinterpret_cast<const char*>(&numBlocks), sizeof(numBlocks));
+        file.write(reinterpret_cast<const char*>(&indexOffset), sizeof(indexOffset));
+        file.write(reinterpret_cast<const char*>(footer), sizeof(footer));
+        file.flush();
+        bool good ((bool) file);
+        file.close();
+        return good;
+    }
+
+private:
+    std::ofstream file;
+    size_t numGroups = 0;
+    int strategies = 0;
+    std::vector<std::int64_t> counts; //the groups as of the last frame, group-major
+    std::vector<float> taxRates;
+    std::vector<float> segRates;
+    ConflictLog conflicts;
+    std::vector<std::uint8_t> lost; //by group: lost a conflict this generation
+    std::vector<std::uint32_t> groups; //the ones that may have changed this generation
+    std::vector<std::uint8_t> entries; //this frame's groups, until we know how many there are
+    std::vector<std::uint8_t> block; //the keyframe and frames of the block in progress
+    size_t keyframeBytes = 0;
+    std::uint32_t frames = 0;
+    std::uint64_t played = 0; //generations recorded
+    std::uint64_t blockStart = 0;
+    std::uint64_t offset = 0; //where the next block goes
+    std::vector<HistoryIndexEntry> index;
+
+    void startBlock() {
+        block.clear();
+        frames = 0;
+        blockStart = played;
+        for (size_t g (0); g < numGroups; ++g) {
+            for (int c (0); c < strategies; ++c) {
+                putVarint(block, (std::uint64_t) counts[g * strategies + c]);
+            }
+            putFloat(block, taxRates[g]);
+            putFloat(block, segRates[g]);
+        }
+        keyframeBytes = block.size();
+    }
+
+    void finishBlock() {
+        HistoryBlockHeader header {HISTORY_BLOCK_MAGIC, frames, blockStart, block.size()};
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(block.data()), (std::streamsize) block.size());
+        index.push_back(HistoryIndexEntry {blockStart, offset});
+        offset += sizeof(header) + block.size();
+    }
+};
+
+//the groups as they were after one generation, as HistoryFile::seek rebuilds them
+struct HistoryState {
+    std::vector<std::int64_t> counts; //strategies per group, group-major
+    std::vector<float> taxRates;
+    std::vector<float> segRates;
+    std::vector<std::uint32_t> winners; //that generation's conflicts
+    std::vector<std::uint32_t> losers;
+};
+
+class HistoryFile {
+public:
+    explicit HistoryFile(const std::string& path) : file(path, std::ios::binary) {
+        char magic[8];
+        file.read(magic, sizeof(magic));
+        file.read(reinterpret_cast<char*>(&head), sizeof(head));
+        if (!file || std::memcmp(magic, HISTORY_MAGIC, sizeof(magic)) != 0) {
+            problem = "it isn't a history file";
+            return;
+        }
+        if (head.version != HISTORY_VERSION || head.byteOrder != TRAJECTORY_BYTE_ORDER) {
+            problem = "it was written by a different version or machine";
+            return;
+        }
+        if (head.strategies < 2 || head.strategies > 4 || head.numGroups == 0) {
+            problem = "it's corrupt";
+            return;
+        }
+        file.seekg(0, std::ios::end);
+        std::uint64_t size ((std::uint64_t) file.tellg());
+        if (!readIndex(size)) {
+            walkBlocks(size);
+        }
+        if (index.empty()) {
+            problem = "it has no complete blocks";
+            return;
+        }
+        HistoryBlockHeader last;
+        if (!readBlockHeader(index.back().offset, last)) {
+            problem = "it's corrupt";
+            return;
+        }
+        played = last.start + last.frames;
+    }
+
+    HistoryFile(const HistoryFile&) = delete;
+    HistoryFile& operator= (const HistoryFile&) = delete;
+
+    //empty if the file is usable, otherwise what's wrong with it
+    const std::string& error() const {
+        return problem;
+    }
+
+    const HistoryHeader& header() const {
+        return head;
+    }
+
+    //how many generations it holds
+    std::uint64_t generations() const {
+        return played;
+    }
+
+    //the groups after generation g (from 0, as the CSV's Time); false if the file doesn't get that far or is corrupt
+    bool seek(std::uint64_t g, HistoryState& state) {
+        if (g >= played) {
+            return false;
+        }
+        //the last block with at least one frame before g + 1, so that generation g's conflicts are in it
+        auto after = std::upper_bound(index.begin(), index.end(), g,
+                                      [](std::uint64_t value, const HistoryIndexEntry& entry) { return value < entry.start; });
+        const HistoryIndexEntry& entry = *(after - 1);
+        HistoryBlockHeader header;
+        if (!readBlockHeader(entry.offset, header) || g - header.start >= header.frames) {
+            return false;
+        }
+        payload.resize(header.payloadBytes);
+        file.read(reinterpret_cast<char*>(payload.data()), (std::streamsize) payload.size());
+        if (!file) {
+            return false;
+        }
+
+        HistoryCursor in {payload.data(), payload.data() + payload.size()};
+        size_t strategies (head.strategies);
+        state.counts.resize(head.numGroups * strategies);
+        state.taxRates.resize(head.numGroups);
+        state.segRates.resize(head.numGroups);
+        for (size_t k (0); k < head.numGroups; ++k) {
+            for (size_t c (0); c < strategies; ++c) {
+                state.counts[k * strategies + c] = (std::int64_t) in.varint();
+            }
+            state.taxRates[k] = in.raw();
+            state.segRates[k] = in.raw();
+        }
+        for (std::uint64_t frame (header.start); frame <= g && in.good; ++frame) {
+            size_t numConflicts (in.varint());
+            if (numConflicts > head.numGroups / 2) {
+                return false;
+            }
+            state.winners.resize(numConflicts);
+            state.losers.resize(numConflicts);
+            for (size_t c (0); c < numConflicts; ++c) {
+                state.winners[c] = (std::uint32_t) in.varint();
+                state.losers[c] = (std::uint32_t) in.varint();
+                if (state.winners[c] >= head.numGroups || state.losers[c] >= head.numGroups) {
+                    return false;
+                }
+            }
+            size_t numEntries (in.varint());
+            std::uint64_t k (~std::uint64_t(0));
+            for (size_t e (0); e < numEntries && in.good; ++e) {
+                std::uint8_t code (in.byte());
+                std::uint64_t gap (code >> 5);
+                if (gap == 7) {
+                    gap += in.varint();
+                }
+                k += gap + 1;
+                if (k >= head.numGroups) {
+                    return false;
+                }
+                state.taxRates[k] = in.stepped(state.taxRates[k], code & 3);
+                state.segRates[k] = in.stepped(state.segRates[k], code >> 2 & 3);
+                if (code & 16) {
+                    for (size_t c (0); c < strategies; ++c) {
+                        state.counts[k * strategies + c] += in.signedVarint();
+                    }
+                }
+            }
+            for (size_t c (0); c < numConflicts; ++c) {
+                state.taxRates[state.losers[c]] = state.taxRates[state.winners[c]];
+                state.segRates[state.losers[c]] = state.segRates[state.winners[c]];
+            }
+        }
+        return in.good;
+    }
+
+private:
+    std::ifstream file;
+    HistoryHeader head {};
+    std::string problem;
+    std::vector<HistoryIndexEntry> index;
+    std::uint64_t played = 0;
+    std::vector<std::uint8_t> payload;
+
+    bool readBlockHeader(std::uint64_t at, HistoryBlockHeader& header) {
+        file.clear();
+        file.seekg((std::streamoff) at);
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        return (bool) file && header.magic == HISTORY_BLOCK_MAGIC;
+    }
+
+    bool readIndex(std::uint64_t size) {
+        std::uint64_t footer[3];
+        std::uint64_t start (sizeof(HISTORY_MAGIC) + sizeof(HistoryHeader));
+        if (size < start + sizeof(footer)) {
+            return false;
+        }
+        file.seekg((std::streamoff) (size - sizeof(footer)));
+        file.read(reinterpret_cast<char*>(footer), sizeof(footer));
+        std::uint64_t numBlocks (footer[0]);
+        std::uint64_t indexOffset (footer[1]);
+        if (!file || (std::uint32_t) footer[2] != HISTORY_INDEX_MAGIC || indexOffset < start
+            || indexOffset + numBlocks * sizeof(HistoryIndexEntry) + sizeof(footer) != size) {
+            file.clear();
+            return false;
+        }
+        index.resize(numBlocks);
+        file.seekg((std::streamoff) indexOffset);
+        file.read(reinterpret_cast<char*>(index.data()), (std::streamsize) (numBlocks * sizeof(HistoryIndexEntry)));
+        return (bool) file;
+    }
+
+    //for a run that never got to write its index: every whole block from the start
+    void walkBlocks(std::uint64_t size) {
+        index.clear();
+        std::uint64_t at (sizeof(HISTORY_MAGIC) + sizeof(HistoryHeader));
+        HistoryBlockHeader header;
+        while (at + sizeof(header) <= size && readBlockHeader(at, header) && header.payloadBytes <= size - at - sizeof(header)) {
+            index.push_back(HistoryIndexEntry {header.start, at});
+            at += sizeof(header) + header.payloadBytes;
+        }
+        file.clear();
+    }
+};
+
+//writes the groups after generation g of a history file as a CSV, one row per group
+bool replayHistory(const std::string& historyPath, const std::string& generation, const std::string& csvPath) {
+    HistoryFile history (historyPath);
+    if (!history.error().empty()) {
+        std::cerr << "Can't replay " << historyPath << ": " << history.error() << "\n";
+        return false;
+    }
+    char* end;
+    errno = 0;
+    std::uint64_t g (std::strtoull(generation.c_str(), &end, 10));
+    if (!std::isdigit((unsigned char) generation[0]) || *end != '\0' || errno == ERANGE) {
+        std::cerr << "--replay takes a generation number, not " << generation << "\n";
+        return false;
+    }
+    HistoryState state;
+    auto started = std::chrono::steady_clock::now();
+    if (!history.seek(g, state)) {
+        std::cerr << historyPath << " holds generations 0-" << history.generations() - 1 << " and couldn't give " << g
+                  << (g < history.generations() ? "; it's corrupt" : "") << "\n";
+        return false;
+    }
+    double seconds (std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count());
+
+    const HistoryHeader& h = history.header();
+    std::vector<std::int64_t> opponent (h.numGroups, -1);
+    std::vector<std::uint8_t> won (h.numGroups, 0);
+    for (size_t c (0); c < state.winners.size(); ++c) {
+        opponent[state.winners[c]] = state.losers[c];
+        opponent[state.losers[c]] = state.winners[c];
+        won[state.winners[c]] = 1;
+    }
+
+    std::ofstream out (csvPath);
+    out << "Group,Size";
+    for (std::uint32_t c (0); c < h.strategies; ++c) {
+        out << "," << STRATEGY_COLUMNS[std::min<std::uint32_t>(h.game, 2)][c];
+    }
+    out << ",Tax Rate,Segmentation Rate,Opponent,Won\n";
+    for (size_t k (0); k < h.numGroups; ++k) {
+        const std::int64_t* counts = &state.counts[k * h.strategies];
+        out << k << "," << std::accumulate(counts, counts + h.strategies, std::int64_t(0));
+        for (std::uint32_t c (0); c < h.strategies; ++c) {
+            out << "," << counts[c];
+        }
+        out << "," << state.taxRates[k] << "," << state.segRates[k] << ",";
+        if (opponent[k] >= 0) {
+            out << opponent[k] << "," << (int) won[k];
+        }
+        else {
+            out << ",";
+        }
+        out << "\n";
+    }
+    if (!out) {
+        std::cerr << "Couldn't write " << csvPath << "\n";
+        return false;
+    }
+    std::cout << "Generation " << g << " of " << history.generations() << " rebuilt in " << seconds * 1000 << " ms" << std::endl;
+    return true;
+}
+
+#if EVOSIM_TELEMETRY
+
+/*
+Collects the slots' counts at the end of each generation, along with heap use and the group-size spread, and
+writes them out as a CSV row and/or trace events. All of it happens on the main thread between generations.
+*/
+class TelemetryRecorder {
+public:
+    TelemetryRecorder(const std::string& csvPath, const std::string& tracePath) {
+        if (!csvPath.empty()) {
+            csv.open(csvPath);
+            good = good && (bool) csv;
+            csv << "generation";
+            for (const char* name : TRACE_PHASE_NAMES) {
+                csv << "," << name << "_seconds";
+            }
+            csv << ",allocations,allocated_bytes,rng_words,groups,min_size,median_size,p90_size,max_size,mean_size\n";
+        }
+        if (!tracePath.empty()) {
+            trace.open(tracePath);
+            good = good && (bool) trace;
+            trace << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                  << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"generation loop\"}}";
+        }
+        mainSlot = &telemetrySlot();
+        origin = telemetryClock();
+        telemetryEnabled = true;
+        mark();
+    }
+
+    bool ok() const {
+        return good;
+    }
+
+    template <typename GroupType>
+    void endGeneration(int j, const std::vector<GroupType>& world) {
+        std::uint64_t nanos[NUM_TRACE_PHASES] = {};
+        std::uint64_t rngWords (0);
+        int numSlots (std::min(telemetryThreads.load(), MAX_TELEMETRY_THREADS));
+        for (int t (0); t < numSlots; ++t) {
+            for (int p (0); p < NUM_TRACE_PHASES; ++p) {
+                nanos[p] += telemetrySlots[t].phaseNanos[p];
+            }
+            rngWords += telemetrySlots[t].rngWords;
+        }
+        for (int p (0); p < NUM_TRACE_PHASES; ++p) {
+            std::swap(nanos[p], lastNanos[p]);
+            nanos[p] = lastNanos[p] - nanos[p];
+        }
+        std::swap(rngWords, lastRngWords);
+        rngWords = lastRngWords - rngWords;
+        std::uint64_t allocations (heapAllocations.load() - lastAllocations);
+        std::uint64_t allocatedBytes (heapAllocatedBytes.load() - lastAllocatedBytes);
+
+        sizes.resize(world.size());
+        std::uint64_t totalSize (0);
+        for (size_t g (0); g < world.size(); ++g) {
+            sizes[g] = world[g].getSize();
+            totalSize += sizes[g];
+        }
+        size_t minSize (0), medianSize (0), p90Size (0), maxSize (0);
+        if (!sizes.empty()) {
+            std::nth_element(sizes.begin(), sizes.begin() + sizes.size() / 2, sizes.end());
+            medianSize = sizes[sizes.size() / 2];
+            std::nth_element(sizes.begin(), sizes.begin() + sizes.size() * 9 / 10, sizes.end());
+            p90Size = sizes[sizes.size() * 9 / 10];
+            auto [lowest, highest] = std::minmax_element(sizes.begin(), sizes.end());
+            minSize = *lowest;
+            maxSize = *highest;
+        }
+        double meanSize (world.empty() ? 0 : (double) totalSize / (double) world.size());
+
+        if (csv.is_open()) {
+            csv << j;
+            for (int p (0); p < NUM_TRACE_PHASES; ++p) {
+                csv << "," << (double) nanos[p] * 1e-9;
+            }
+            csv << "," << allocations << "," << allocatedBytes << "," << rngWords << "," << world.size() << "," << minSize
+                << "," << medianSize << "," << p90Size << "," << maxSize << "," << meanSize << "\n";
+        }
+        if (trace.is_open()) {
+            //spans for the main thread's phases; play and reproduce go in as arguments, being spread over threads
+            for (TracePhase phase : {TracePhase::WithinGroup, TracePhase::Shuffle, TracePhase::War, TracePhase::Statistics,
+                                     TracePhase::Output}) {
+                int p ((int) phase);
+                trace << ",\n{\"name\":\"" << TRACE_PHASE_NAMES[p] << "\",\"cat\":\"phase\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":"
+                      << microseconds(mainSlot->lastStart[p]) << ",\"dur\":" << (double) nanos[p] * 1e-3
+                      << ",\"args\":{\"generation\":" << j;
+                if (phase == TracePhase::WithinGroup) {
+                    trace << ",\"play_cpu_us\":" << (double) nanos[(int) TracePhase::Play] * 1e-3
+                          << ",\"reproduce_cpu_us\":" << (double) nanos[(int) TracePhase::Reproduce] * 1e-3;
+                }
+                trace << "}}";
+            }
+            double now (microseconds(telemetryClock()));
+            trace << ",\n{\"name\":\"heap\",\"ph\":\"C\",\"pid\":1,\"ts\":" << now << ",\"args\":{\"allocations\":" << allocations
+                  << ",\"bytes\":" << allocatedBytes << "}}"
+                  << ",\n{\"name\":\"rng words\",\"ph\":\"C\",\"pid\":1,\"ts\":" << now << ",\"args\":{\"words\":" << rngWords << "}}"
+                  << ",\n{\"name\":\"group size\",\"ph\":\"C\",\"pid\":1,\"ts\":" << now << ",\"args\":{\"min\":" << minSize
+                  << ",\"median\":" << medianSize << ",\"p90\":" << p90Size << ",\"max\":" << maxSize << "}}";
+        }
+        mark(); //so that our own writing isn't counted against the next generation
+    }
+
+    void close() {
+        telemetryEnabled = false;
+        if (trace.is_open()) {
+            trace << "\n]}\n";
+            trace.close();
+        }
+        if (csv.is_open()) {
+            csv.close();
+        }
+    }
+
+private:
+    bool good = true;
+    std::ofstream csv;
+    std::ofstream trace;
+    TelemetrySlot* mainSlot;
+    std::uint64_t origin;
+    std::uint64_t lastNanos[NUM_TRACE_PHASES] = {};
+    std::uint64_t lastRngWords = 0;
+    std::uint64_t lastAllocations = 0;
+    std::uint64_t lastAllocatedBytes = 0;
+    std::vector<size_t> sizes;
+
+    double microseconds(std::uint64_t clock) const {
+        return (double) (clock - origin) * 1e-3;
+    }
+
+    void mark() {
+        lastAllocations = heapAllocations.load();
+        lastAllocatedBytes = heapAllocatedBytes.load();
+    }
+};
+
+TelemetryRecorder* activeTelemetry = nullptr; //set by main when --telemetry or --trace is given
+
+#endif //EVOSIM_TELEMETRY
+
+//decimated or averaged output, so that a long run's output stays a manageable size
+template <typename GroupType>
+void outputGeneration(TrajectoryWriter& writer, WindowStats& window, const RunOptions& options, int j, int iterations,
+                      const WorldStats& stats, float conflictChance, const WorldStatistics& statistics,
+                      const std::vector<GroupType>& world) {
+    bool write;
+    if (options.outputWindow > 0) {
+        window.add(j, stats, conflictChance);
+        write = window.count == (std::uint64_t) options.outputWindow || j == iterations - 1;
+    }
+    else {
+        write = j % options.outputEvery == 0 || j == iterations - 1;
+    }
+    if (!write) {
+        return;
+    }
+    GenerationRecord& record = writer.beginRecord();
+    if (options.outputWindow > 0) {
+        window.finish(record);
+    }
+    else {
+        record.generation = j;
+        record.stats = stats;
+        record.conflictChance = conflictChance;
+    }
+    {
+        EVOSIM_TIME_PHASE(TracePhase::Statistics);
+        if (options.distributions) {
+            statistics.distribution(record.distribution);
+        }
+        fillRecord(record, world, writer.wantsGroupStates());
+    }
+    EVOSIM_TIME_PHASE(TracePhase::Output);
+    writer.commitRecord();
+}
+
+template <typename GroupType>
+bool runSimulation(const RunOptions& options, ThreadPool& pool, int iterations, TrajectoryWriter& writer,
+                   const CheckpointOptions& checkpoint = CheckpointOptions(), const SnapshotFile* resumeFrom = nullptr,
+                   RunControl control = RunControl()) {
+    std::vector<GroupType> world;
+    ConflictChanceSeries conflictChance (options.seed, iterations, options.params.groupConflictChance, options.streaming);
+    WorldStatistics statistics;
+    WindowStats window;
+    int start (0);
+    if (resumeFrom != nullptr) {
+        world = restoreWorld<GroupType>(*resumeFrom);
+        start = (int) resumeFrom->header().nextGeneration;
+        window = resumeFrom->header().window;
+        if (conflictChance.isStreaming()) {
+            conflictChance.restart(start, resumeFrom->header().conflictDeviation);
+        }
+        if (start < iterations && conflictChance[start] != resumeFrom->header().nextConflictChance) {
+            std::cerr << "The conflict chance series doesn't match the checkpoint's; was it written by a different build?\n";
+            return false;
+        }
+    }
+    else {
+        world = makeWorld<GroupType>(options);
+    }
+    statistics.rebuild(world);
+    if (control.history != nullptr) {
+        control.history->begin(options, world);
+    }
+
+    //allocations are only counted over the second half of the run, once the buffers have grown to size
+    std::uint64_t steadyAllocations (0);
+    std::uint64_t steadyBytes (0);
+    int warmUp (start + (iterations - start) / 2);
+    int end (iterations);
+    ThreadPool* threads (&pool);
+    std::unique_ptr<ThreadPool> grownPool;
+
+    for (int j (start); j < iterations; ++j) { //Now run everything
+        if (control.cores != nullptr && control.cores->share() > threads->size()) {
+            grownPool = std::make_unique<ThreadPool>(control.cores->share());
+            threads = grownPool.get();
+        }
+        std::uint64_t allocationsBefore (heapAllocations.load());
+        std::uint64_t bytesBefore (heapAllocatedBytes.load());
+        WorldStats stats = runGeneration(world, j, conflictChance[j], options, *threads, statistics,
+                                         control.history != nullptr ? &control.history->conflictLog() : nullptr);
+        if (j >= warmUp) {
+            steadyAllocations += heapAllocations.load() - allocationsBefore;
+            steadyBytes += heapAllocatedBytes.load() - bytesBefore;
+        }
+
+        //stopping early makes this the last generation, so the output closes its window here
+        if (control.monitor != nullptr && control.monitor->add(stats)) {
+            end = j + 1;
+        }
+        outputGeneration(writer, window, options, j, end, stats, conflictChance[j], statistics, world);
+        {
+            EVOSIM_TIME_PHASE(TracePhase::Output);
+
+            if (control.history != nullptr) {
+                control.history->record(world, statistics);
+            }
+
+            if (!checkpoint.path.empty() && checkpoint.every > 0 && (j + 1) % checkpoint.every == 0) {
+                SnapshotHeader header {};
+                header.seed = options.seed;
+                header.nextGeneration = j + 1;
+                header.iterations = iterations;
+                header.countEngine = std::is_same_v<GroupType, CountGroup> ? 1 : 0;
+                header.reproductionMode = (std::uint32_t) options.reproductionMode;
+                header.groupConflictChance = options.params.groupConflictChance;
+                header.individualMutationRate = options.params.individualMutationRate;
+                header.institutionalChangeChance = options.params.institutionalChangeChance;
+                header.initialGroups = options.params.initialGroups;
+                header.agentsMultiplier = options.params.agentsMultiplier;
+                header.groupStates = writer.wantsGroupStates() ? 1 : 0;
+                header.nextConflictChance = j + 1 < iterations ? conflictChance[j + 1] : 0;
+                header.streaming = options.streaming ? 1 : 0;
+                header.conflictDeviation = conflictChance.getDeviation();
+                header.outputEvery = options.outputEvery;
+                header.outputWindow = options.outputWindow;
+                header.window = window;
+                header.game = (std::uint32_t) options.game;
+                header.skipAhead = options.skipAhead ? 1 : 0;
+                header.distributions = options.distributions ? 1 : 0;
+                writer.sync(header.csvBytes, header.trajectoryBytes);
+                if (!writeSnapshot(checkpoint.path, header, world)) {
+                    return false;
+                }
+            }
+        }
+#if EVOSIM_TELEMETRY
+        if (activeTelemetry != nullptr) {
+            activeTelemetry->endGeneration(j, world);
+        }
+#endif
+        if (end != iterations) {
+            break;
+        }
+    }
+
+    if (options.countAllocations) {
+        std::cout << "Heap allocations in generations " << std::min(warmUp, end) << "-" << end - 1 << ": "
+                  << steadyAllocations << " (" << steadyBytes << " bytes)" << std::endl;
+    }
+    return true;
+}
+
+/*
+Runs body with a std::type_identity of the group type for the engine and game: the one place where the
+choice of game turns into which compiled version of the per-agent code runs.
+*/
+template <typename Body>
+auto withGroupType(bool countEngine, GameKind game, Body&& body) {
+    if (countEngine) {
+        return body(std::type_identity<CountGroup>());
+    }
+    switch (game) {
+    case GameKind::Loners:
+        return body(std::type_identity<BasicGroup<LonersGame>>());
+    case GameKind::Punishers:
+        return body(std::type_identity<BasicGroup<PunishersGame>>());
+    default:
+        return body(std::type_identity<Group>());
+    }
+}
+
+/*
+Parameter sweeps. A sweep spec is a small text file, one setting per line (# starts a comment):
+
+    design grid           grid (every combination of the listed values) or lhs (Latin hypercube)
+    samples 50            lhs only: how many points
+    replicates 10         runs per point
+    generations 5000
+    mutation-rate 0.001 0.005 0.01      grid: the values to try; lhs: min max
+    groups 100 200
+
+Parameter names are the same as the command line flags (conflict-chance, mutation-rate, institution-chance,
+groups, agents); anything not listed keeps its command line value. Every (point, replicate) is a job and the jobs
+share one thread pool; each writes its own CSV (<output>_p<point>_r<replicate>.csv) and <output>_index.csv says
+which file holds what. Replicate r gets the same seed at every point, so points are compared on common random
+numbers. With --precision every job stops once its cooperation has converged (see ConvergenceMonitor), and
+<output>_convergence.csv says when and why each one stopped.
+*/
+
+/*
+Sharded runs (--shards N), for worlds too big to sit well on one NUMA node. The groups are split into N
+contiguous ranges of ids, each stepped by its own process with its own thread pool, pinned to a NUMA node when
+the machine has more than one, so that its groups live in that node's memory. Shard 0 is the main process and
+does the output.
+
+Shard 0 draws the war line-up (drawWar over all the ids) at the start of each generation and sends every other
+shard just the pairs it is in, so only shard 0 does work or holds memory in proportion to the whole world. The
+draw is one shuffle of every id, which can't be split up without changing the line-up, so it stays in one place
+rather than being repeated by every shard. Pairs inside a shard are fought there. For a pair across two shards,
+each side sends the other its group through a ring buffer in shared memory, then both fight the pair with the
+pair's stream and keep their own group's half of the result, which comes out the same on both sides. So only the groups drawn into cross-shard
+conflicts move, in one exchange per generation, after which the world statistics are reduced on shard 0 (see
+WorldStatistics::pack). The output is identical to an unsharded run's.
+
+Checkpoints, group states, telemetry and sweeps are single-process features for now.
+*/
+
+const size_t SHARD_RING_BYTES = 1 << 18;
+const unsigned MAX_SHARDS = 64;
+
+//a one-way byte stream between two shards; the counts of bytes written and read only ever grow
+struct ShardRing {
+    alignas(64) std::atomic<std::uint64_t> written;
+    alignas(64) std::atomic<std::uint64_t> read;
+    alignas(64) char data[SHARD_RING_BYTES];
+};
+
+struct alignas(64) ShardShared {
+    std::atomic<int> failed; //raised by a shard that gives up, so that the others stop waiting on it
+};
+
+//shard s holds groups [shardFirst(s), shardFirst(s + 1))
+size_t shardFirst(std::uint64_t numGroups, unsigned numShards, unsigned shard) {
+    return (size_t) (numGroups * shard / numShards);
+}
+
+//the shard group id is in: the largest s with shardFirst(s) <= id
+unsigned shardOf(std::uint64_t id, std::uint64_t numGroups, unsigned numShards) {
+    return (unsigned) (((id + 1) * numShards - 1) / numGroups);
+}
+
+size_t shardRegionBytes(unsigned numShards) {
+    return sizeof(ShardShared) + (size_t) numShards * numShards * sizeof(ShardRing);
+}
+
+size_t ringWrite(ShardRing& ring, const char* from, size_t n) {
+    std::uint64_t written (ring.written.load(std::memory_order_relaxed));
+    n = std::min(n, (size_t) (SHARD_RING_BYTES - (written - ring.read.load(std::memory_order_acquire))));
+    size_t at (written % SHARD_RING_BYTES);
+    size_t first (std::min(n, SHARD_RING_BYTES - at));
+    std::memcpy(ring.data + at, from, first);
+    std::memcpy(ring.data, from + first, n - first);
+    ring.written.store(written + n, std::memory_order_release);
+    return n;
+}
+
+size_t ringRead(ShardRing& ring, char* to, size_t n) {
+    std::uint64_t read (ring.read.load(std::memory_order_relaxed));
+    n = std::min(n, (size_t) (ring.written.load(std::memory_order_acquire) - read));
+    size_t at (read % SHARD_RING_BYTES);
+    size_t first (std::min(n, SHARD_RING_BYTES - at));
+    std::memcpy(to, ring.data + at, first);
+    std::memcpy(to + first, ring.data, n - first);
+    ring.read.store(read + n, std::memory_order_release);
+    return n;
+}
+
+/*
+One shard's end of the rings. Messages go as frames (a u64 length, then the bytes) built in outgoing(peer)
+and arrive in incoming(peer). transfer() pushes and pulls all of a round's frames in one loop, so two shards
+sending each other more than a ring holds never end up both waiting for the other to read.
+*/
+class ShardLinks {
+public:
+    ShardLinks(void* region, unsigned numShards, unsigned self, pid_t parent, std::vector<pid_t> children)
+        : shared(static_cast<ShardShared*>(region)),
+          rings(reinterpret_cast<ShardRing*>(static_cast<char*>(region) + sizeof(ShardShared))),
+          numShards(numShards), self(self), parent(parent), children(std::move(children)),
+          out(numShards), in(numShards), sent(numShards), received(numShards), lengths(numShards) {}
+
+    unsigned shard() const {
+        return self;
+    }
+
+    std::vector<char>& outgoing(unsigned peer) {
+        return out[peer];
+    }
+
+    const std::vector<char>& incoming(unsigned peer) const {
+        return in[peer];
+    }
+
+    //every shard but this one, as a mask for transfer
+    std::uint64_t peers() const {
+        return ((numShards == 64 ? 0 : (1ull << numShards)) - 1) & ~(1ull << self);
+    }
+
+    //sends outgoing(p) to each p in sendTo and fills in incoming(p) from each p in receiveFrom
+    bool transfer(std::uint64_t sendTo, std::uint64_t receiveFrom) {
+        std::fill(sent.begin(), sent.end(), 0);
+        std::fill(received.begin(), received.end(), 0);
+        std::uint64_t sending (sendTo);
+        std::uint64_t receiving (receiveFrom);
+        long idle (0);
+        while (sending != 0 || receiving != 0) {
+            bool progress (false);
+            for (unsigned p (0); p < numShards; ++p) {
+                if (sending & (1ull << p)) {
+                    progress |= push(p);
+                    if (sent[p] == sizeof(std::uint64_t) + out[p].size()) {
+                        sending &= ~(1ull << p);
+                    }
+                }
+                if (receiving & (1ull << p)) {
+                    progress |= pull(p);
+                    if (received[p] >= sizeof(std::uint64_t) && received[p] == sizeof(std::uint64_t) + lengths[p]) {
+                        receiving &= ~(1ull << p);
+                    }
+                }
+            }
+            if (progress) {
+                idle = 0;
+                continue;
+            }
+            //somebody is still busy; back off, and every so often make sure they're still there at all
+            if (++idle % 1024 == 0 && !peersAlive()) {
+                fail();
+                return false;
+            }
+            if (idle < 64) {
+                std::this_thread::yield();
+            }
+            else {
+                std::this_thread::sleep_for(std::chrono::microseconds(idle < 4096 ? 2 : 100));
+            }
+        }
+        return true;
+    }
+
+    void fail() {
+        shared->failed.store(1);
+    }
+
+    //shard 0 waits for the others; true if they all finished cleanly
+    bool waitForChildren() {
+        bool clean (true);
+        for (pid_t& child : children) {
+            int status;
+            if (child > 0 && waitpid(child, &status, 0) == child) {
+                clean = clean && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                child = 0;
+            }
+        }
+        return clean && !exitedBadly;
+    }
+
+    //shard 0 stops the others after a failure of its own
+    void stopChildren() {
+        fail();
+        for (pid_t child : children) {
+            if (child > 0) {
+                kill(child, SIGTERM);
+            }
+        }
+    }
+
+private:
+    ShardShared* shared;
+    ShardRing* rings;
+    unsigned numShards;
+    unsigned self;
+    pid_t parent;
+    std::vector<pid_t> children; //shard 0's; reaped ones are set to 0
+    bool exitedBadly = false;
+    std::vector<std::vector<char>> out;
+    std::vector<std::vector<char>> in;
+    std::vector<size_t> sent; //bytes of this round's frame so far, the length included
+    std::vector<size_t> received;
+    std::vector<std::uint64_t> lengths;
+
+    ShardRing& ring(unsigned from, unsigned to) {
+        return rings[(size_t) from * numShards + to];
+    }
+
+    bool push(unsigned p) {
+        ShardRing& r = ring(self, p);
+        size_t before (sent[p]);
+        std::uint64_t length (out[p].size());
+        if (sent[p] < sizeof(length)) {
+            sent[p] += ringWrite(r, reinterpret_cast<const char*>(&length) + sent[p], sizeof(length) - sent[p]);
+        }
+        if (sent[p] >= sizeof(length)) {
+            sent[p] += ringWrite(r, out[p].data() + (sent[p] - sizeof(length)), sizeof(length) + length - sent[p]);
+        }
+        return sent[p] != before;
+    }
+
+    bool pull(unsigned p) {
+        ShardRing& r = ring(p, self);
+        size_t before (received[p]);
+        if (received[p] < sizeof(std::uint64_t)) {
+            received[p] += ringRead(r, reinterpret_cast<char*>(&lengths[p]) + received[p], sizeof(std::uint64_t) - received[p]);
+            if (received[p] == sizeof(std::uint64_t)) {
+                in[p].resize(lengths[p]); //only allocates when a frame is bigger than any before it
+            }
+        }
+        if (received[p] >= sizeof(std::uint64_t)) {
+            received[p] += ringRead(r, in[p].data() + (received[p] - sizeof(std::uint64_t)),
+                                    sizeof(std::uint64_t) + lengths[p] - received[p]);
+        }
+        return received[p] != before;
+    }
+
+    bool peersAlive() {
+        if (shared->failed.load() != 0) {
+            return false;
+        }
+        if (self != 0) {
+            return getppid() == parent;
+        }
+        for (pid_t& child : children) {
+            int status;
+            if (child > 0 && waitpid(child, &status, WNOHANG) == child) {
+                child = 0;
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                    exitedBadly = true;
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+//an ostream buffer that appends to a byte vector, so that saveGroup can write a group into a message
+class ByteSink : public std::streambuf {
+public:
+    explicit ByteSink(std::vector<char>& bytes) : bytes(bytes) {}
+
+protected:
+    std::streamsize xsputn(const char* data, std::streamsize n) override {
+        bytes.insert(bytes.end(), data, data + n);
+        return n;
+    }
+
+    int_type overflow(int_type c) override {
+        if (c != traits_type::eof()) {
+            bytes.push_back((char) c);
+        }
+        return c;
+    }
+
+private:
+    std::vector<char>& bytes;
+};
+
+//a group as a message: its length, its snapshot record, then its members (see saveGroup)
+template <typename GroupType>
+void appendGroupMessage(std::vector<char>& out, const GroupType& group) {
+    size_t start (out.size());
+    out.resize(start + sizeof(std::uint64_t) + sizeof(SnapshotGroup));
+    ByteSink sink (out);
+    std::ostream members (&sink);
+    SnapshotGroup record {};
+    std::uint64_t offset (0);
+    saveGroup(group, record, members, offset);
+    std::uint64_t length (out.size() - start);
+    std::memcpy(out.data() + start, &length, sizeof(length));
+    std::memcpy(out.data() + start + sizeof(length), &record, sizeof(record));
+}
+
+template <typename GroupType>
+void loadGroupMessage(GroupType& group, const char* message) {
+    SnapshotGroup record;
+    std::memcpy(&record, message + sizeof(std::uint64_t), sizeof(record));
+    loadGroup(group, record, reinterpret_cast<const std::byte*>(message + sizeof(std::uint64_t) + sizeof(record)));
+}
+
+//the CPUs on each NUMA node, from sysfs; one entry (or none) means there's nothing to pin to
+std::vector<std::vector<int>> numaNodeCpus() {
+    std::vector<std::vector<int>> nodes;
+    for (int node (0); ; ++node) {
+        std::ifstream in ("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+        if (!in) {
+            return nodes;
+        }
+        std::vector<int> cpus;
+        std::string range;
+        while (std::getline(in, range, ',')) {
+            int first;
+            int last;
+            int fields (std::sscanf(range.c_str(), "%d-%d", &first, &last));
+            if (fields == 1) {
+                last = first;
+            }
+            for (int cpu (first); fields >= 1 && cpu <= last; ++cpu) {
+                cpus.push_back(cpu);
+            }
+        }
+        nodes.push_back(cpus);
+    }
+}
+
+/*
+One shard's run, groups [first, last) of the world. Its thread pool is made here, after the process has been
+pinned, so the workers inherit the pinning and the groups get allocated on the shard's node. Only shard 0 has
+a writer.
+*/
+template <typename GroupType>
+bool runShard(const RunOptions& options, int iterations, ShardLinks& links, unsigned numShards, unsigned numThreads,
+              TrajectoryWriter* writer) {
+    unsigned shard (links.shard());
+    std::vector<std::vector<int>> nodes (numaNodeCpus());
+    if (nodes.size() > 1) {
+        const std::vector<int>& cpus = nodes[shard % nodes.size()];
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : cpus) {
+            CPU_SET(cpu, &set);
+        }
+        sched_setaffinity(0, sizeof(set), &set);
+        numThreads = std::min(numThreads, (unsigned) std::max<size_t>(cpus.size(), 1));
+    }
+    ThreadPool pool (numThreads);
+
+    std::uint64_t numGroups ((std::uint64_t) options.params.initialGroups);
+    size_t first (shardFirst(numGroups, numShards, shard));
+    size_t last (shardFirst(numGroups, numShards, shard + 1));
+    std::vector<GroupType> world = makeWorld<GroupType>(options, (int) first, (int) last);
+    auto shardOf = [&](std::uint32_t id) { return ::shardOf(id, numGroups, numShards); };
+
+    WorldStatistics statistics;
+    statistics.rebuild(world);
+    WorldStatistics combined; //shard 0's view of the whole world
+    std::vector<char> ownTotals;
+    ConflictChanceSeries conflictChance (options.seed, iterations, options.params.groupConflictChance, options.streaming);
+    WindowStats window;
+
+    std::vector<std::uint32_t> lineUp; //the pairs this shard is in, as (pair, one, two) triples in pair order
+    std::vector<std::uint32_t> localPairs; //where in lineUp
+    std::vector<std::uint32_t> crossPairs;
+    std::vector<const char*> visitorMessages; //each cross pair's group from the other shard
+    std::vector<const char*> cursors (numShards);
+    std::vector<GroupType> visitors;
 
-            int l (0); //this logic lets us use one loop instead of two
-            while (l < INITIAL_GROUPS) { //Let's have a war!
-                if (l < warSize - 1) {
-                    playGroupGame(world[l], world[l+1]);
-                    pCoop += (world[l].getPropCoop() + world[l+1].getPropCoop());
-                    avgTRate += (world[l].getTaxRate() + world[l+1].getTaxRate());
-                    avgSRate += (world[l].getSegRate() + world[l+1].getSegRate());
-                    l += 2;
+    for (int j (0); j < iterations; ++j) {
+        //shard 0 draws the war for everyone; the others only hear about their own pairs
+        if (shard == 0) {
+            ArenaScope scratch (threadArena());
+            std::span<std::uint32_t> order = scratch.allocate<std::uint32_t>((size_t) numGroups);
+            size_t numPairs (drawWar(order, options.seed, j, conflictChance[j]));
+            lineUp.clear();
+            for (unsigned p (0); p < numShards; ++p) {
+                links.outgoing(p).clear();
+            }
+            for (size_t pair (0); pair < numPairs; ++pair) {
+                std::uint32_t triple[3] = {(std::uint32_t) pair, order[2 * pair], order[2 * pair + 1]};
+                unsigned one (shardOf(triple[1]));
+                unsigned two (shardOf(triple[2]));
+                for (unsigned p : {one, two}) {
+                    if (p == 0) {
+                        lineUp.insert(lineUp.end(), triple, triple + 3);
+                    }
+                    else {
+                        appendBytes(links.outgoing(p), triple, sizeof(triple));
+                    }
+                    if (one == two) {
+                        break;
+                    }
+                }
+            }
+            if (!links.transfer(links.peers(), 0)) {
+                return false;
+            }
+        }
+        else {
+            if (!links.transfer(0, 1)) {
+                return false;
+            }
+            const std::vector<char>& drawn = links.incoming(0);
+            lineUp.resize(drawn.size() / sizeof(std::uint32_t));
+            if (!drawn.empty()) {
+                std::memcpy(lineUp.data(), drawn.data(), drawn.size());
+            }
+        }
+
+        playWithinAll(world, first, j, options, pool, statistics);
+
+        //sort this shard's pairs into its own and the cross-shard ones, and send our side of the latter
+        localPairs.clear();
+        crossPairs.clear();
+        for (unsigned p (0); p < numShards; ++p) {
+            links.outgoing(p).clear();
+        }
+        for (size_t t (0); t < lineUp.size(); t += 3) {
+            unsigned one (shardOf(lineUp[t + 1]));
+            unsigned two (shardOf(lineUp[t + 2]));
+            if (one == shard && two == shard) {
+                localPairs.push_back((std::uint32_t) t);
+            }
+            else {
+                crossPairs.push_back((std::uint32_t) t);
+                std::uint32_t mine (one == shard ? lineUp[t + 1] : lineUp[t + 2]);
+                appendGroupMessage(links.outgoing(one == shard ? two : one), world[mine - first]);
+            }
+        }
+        if (!links.transfer(links.peers(), links.peers())) {
+            return false;
+        }
+
+        //the other shards' messages come in the same pair order as ours went out
+        visitorMessages.resize(crossPairs.size());
+        for (unsigned p (0); p < numShards; ++p) {
+            cursors[p] = links.incoming(p).data();
+        }
+        for (size_t c (0); c < crossPairs.size(); ++c) {
+            std::uint32_t t (crossPairs[c]);
+            unsigned one (shardOf(lineUp[t + 1]));
+            unsigned peer (one == shard ? shardOf(lineUp[t + 2]) : one);
+            std::uint64_t length;
+            std::memcpy(&length, cursors[peer], sizeof(length));
+            visitorMessages[c] = cursors[peer];
+            cursors[peer] += length;
+        }
+        if (visitors.size() < crossPairs.size()) {
+            visitors.resize(crossPairs.size());
+        }
+
+        {
+            EVOSIM_TIME_PHASE(TracePhase::War);
+            pool.parallelFor(localPairs.size() + crossPairs.size(), [&](size_t i) {
+                bool local (i < localPairs.size());
+                std::uint32_t t (local ? localPairs[i] : crossPairs[i - localPairs.size()]);
+                std::uint32_t pair (lineUp[t]);
+                std::uint32_t one (lineUp[t + 1]);
+                std::uint32_t two (lineUp[t + 2]);
+                RandomStream conflictRng (options.seed, j, pair, Phase::Conflict);
+                if (local) {
+                    playGroupGame(world[one - first], world[two - first], conflictRng);
+                    statistics.collect(world[one - first], one - first);
+                    statistics.collect(world[two - first], two - first);
+                    return;
+                }
+                GroupType& visitor = visitors[i - localPairs.size()];
+                loadGroupMessage(visitor, visitorMessages[i - localPairs.size()]);
+                std::uint32_t mine (shardOf(one) == shard ? one : two);
+                if (mine == one) {
+                    playGroupGame(world[mine - first], visitor, conflictRng);
                 }
                 else {
-                    pCoop += world[l].getPropCoop();
-                    avgTRate += world[l].getTaxRate();
-                    avgSRate += world[l].getSegRate();
-                    ++l;
+                    playGroupGame(visitor, world[mine - first], conflictRng);
+                }
+                statistics.collect(world[mine - first], mine - first);
+            });
+        }
+
+        EVOSIM_TIME_PHASE(TracePhase::Statistics);
+        statistics.update(world);
+        if (shard != 0) {
+            links.outgoing(0).clear();
+            statistics.pack(links.outgoing(0), options.distributions);
+            if (!links.transfer(1, 0)) {
+                return false;
+            }
+            continue;
+        }
+        if (!links.transfer(0, links.peers())) {
+            return false;
+        }
+        combined.reset((size_t) numGroups);
+        ownTotals.clear();
+        statistics.pack(ownTotals, options.distributions);
+        const char* in = ownTotals.data();
+        combined.unpack(in, options.distributions);
+        for (unsigned p (1); p < numShards; ++p) {
+            in = links.incoming(p).data();
+            combined.unpack(in, options.distributions);
+        }
+        outputGeneration(*writer, window, options, j, iterations, combined.summary(), conflictChance[j], combined, world);
+    }
+    return true;
+}
+
+//forks the other shards, runs shard 0 here and waits for the rest; returns main's exit code
+int runShards(const RunOptions& options, bool countEngine, int iterations, unsigned numShards, unsigned numThreads,
+              const std::string& outputFile, const std::string& trajectoryFile) {
+    size_t regionBytes (shardRegionBytes(numShards));
+    void* region = mmap(nullptr, regionBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        std::cerr << "Couldn't map " << regionBytes << " bytes of shared memory for the shards\n";
+        return 1;
+    }
+    new (region) ShardShared {};
+    for (size_t r (0); r < (size_t) numShards * numShards; ++r) {
+        new (static_cast<char*>(region) + sizeof(ShardShared) + r * sizeof(ShardRing)) ShardRing {};
+    }
+    unsigned threadsPerShard (std::max(1u, numThreads / numShards));
+
+    std::cout << std::flush; //or the children would write out whatever is buffered again
+    pid_t parent (getpid());
+    std::vector<pid_t> children;
+    for (unsigned shard (1); shard < numShards; ++shard) {
+        pid_t child (fork());
+        if (child < 0) {
+            std::cerr << "Couldn't start shard " << shard << "\n";
+            ShardLinks (region, numShards, 0, parent, children).stopChildren();
+            return 1;
+        }
+        if (child == 0) {
+            ShardLinks links (region, numShards, shard, parent, {});
+            bool ok = withGroupType(countEngine, options.game, [&](auto type) {
+                return runShard<typename decltype(type)::type>(options, iterations, links, numShards, threadsPerShard, nullptr);
+            });
+            if (!ok) {
+                links.fail();
+            }
+            _exit(ok ? 0 : 1); //no destructors or atexit: those belong to the parent
+        }
+        children.push_back(child);
+    }
+
+    ShardLinks links (region, numShards, 0, parent, children);
+    bool ok;
+    {
+        TrajectoryWriter writer (outputFile, trajectoryFile, options.params.initialGroups, false, true, false,
+                                 options.outputWindow > 0, options.distributions);
+        ok = writer.ok() && withGroupType(countEngine, options.game, [&](auto type) {
+            return runShard<typename decltype(type)::type>(options, iterations, links, numShards, threadsPerShard, &writer);
+        });
+        writer.close();
+        ok = ok && writer.ok();
+    }
+    if (!ok) {
+        links.stopChildren();
+    }
+    ok = links.waitForChildren() && ok;
+    munmap(region, regionBytes);
+    if (!ok) {
+        std::cerr << "The sharded run failed\n";
+        return 1;
+    }
+    return 0;
+}
+
+bool setParam(Params& params, const std::string& name, double value) {
+    if (name == "conflict-chance") {
+        params.groupConflictChance = (float) value;
+    }
+    else if (name == "mutation-rate") {
+        params.individualMutationRate = (float) value;
+    }
+    else if (name == "institution-chance") {
+        params.institutionalChangeChance = (float) value;
+    }
+    else if (name == "groups") {
+        params.initialGroups = (int) std::lround(value);
+    }
+    else if (name == "agents") {
+        params.agentsMultiplier = (int) std::lround(value);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+bool isIntegerParam(const std::string& name) {
+    return name == "groups" || name == "agents";
+}
+
+//a whole number in [min, max] from the command line; false for anything else, trailing junk included
+template <typename Integer>
+bool parseInteger(const char* text, long long min, long long max, Integer& value) {
+    char* end;
+    errno = 0;
+    long long number (std::strtoll(text, &end, 10));
+    if (end == text || *end != '\0' || errno == ERANGE || number < min || number > max) {
+        return false;
+    }
+    value = (Integer) number;
+    return true;
+}
+
+//the same for a real number in [min, max] (which NaN never is)
+bool parseNumber(const char* text, double min, double max, double& value) {
+    char* end;
+    double number (std::strtod(text, &end));
+    if (end == text || *end != '\0' || !(number >= min && number <= max)) {
+        return false;
+    }
+    value = number;
+    return true;
+}
+
+//a seed is any 64-bit number; strtoull would take "-1" as 2^64 - 1, so it has to start with a digit
+bool parseSeed(const char* text, std::uint64_t& seed) {
+    if (!std::isdigit((unsigned char) text[0])) {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    unsigned long long number (std::strtoull(text, &end, 10));
+    if (*end != '\0' || errno == ERANGE) {
+        return false;
+    }
+    seed = number;
+    return true;
+}
+
+bool isParam(const std::string& name) {
+    Params check;
+    return setParam(check, name, 0);
+}
+
+//group counts and sizes are at least 1 (and fit an int), the rest are probabilities
+bool paramInRange(const std::string& name, double value) {
+    if (isIntegerParam(name)) {
+        return value >= 1 && value <= std::numeric_limits<int>::max();
+    }
+    return value >= 0 && value <= 1;
+}
+
+//what paramInRange wants, for error messages
+std::string paramRange(const std::string& name) {
+    return isIntegerParam(name) ? "a whole number, at least 1" : "a probability, from 0 to 1";
+}
+
+//a model parameter flag's value from the command line; false if name isn't a parameter or value isn't a number in its range
+bool parseParamArgument(Params& params, const std::string& name, const char* value) {
+    if (!isParam(name)) {
+        return false;
+    }
+    double number;
+    if (!parseNumber(value, -HUGE_VAL, HUGE_VAL, number) || !paramInRange(name, number)) {
+        return false;
+    }
+    return setParam(params, name, number);
+}
+
+struct SweepSpec {
+    bool latinHypercube = false;
+    int samples = 0;
+    int replicates = 1;
+    int generations = 0; //0 = keep the command line value
+    std::vector<std::pair<std::string, std::vector<double>>> axes;
+};
+
+//true if a spec line has been read to its end without stopping at a word that isn't what was asked for
+bool readToEnd(std::istringstream& words) {
+    if (words.fail() && !words.eof()) {
+        return false;
+    }
+    words.clear();
+    words >> std::ws;
+    return words.eof();
+}
+
+bool parseSweepSpec(const std::string& path, SweepSpec& spec) {
+    std::ifstream inf (path);
+    if (!inf) {
+        std::cerr << "Couldn't open sweep spec " << path << "\n";
+        return false;
+    }
+    std::string line;
+    int lineNumber (0);
+    while (std::getline(inf, line)) {
+        ++lineNumber;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words (line);
+        std::string key;
+        if (!(words >> key)) {
+            continue;
+        }
+        if (key == "design") {
+            std::string design;
+            words >> design;
+            if (design != "grid" && design != "lhs") {
+                std::cerr << path << ":" << lineNumber << ": design is grid or lhs\n";
+                return false;
+            }
+            spec.latinHypercube = (design == "lhs");
+        }
+        else if (key == "samples" || key == "replicates" || key == "generations") {
+            int& count (key == "samples" ? spec.samples : key == "replicates" ? spec.replicates : spec.generations);
+            if (!(words >> count) || !readToEnd(words) || count < 1) {
+                std::cerr << path << ":" << lineNumber << ": " << key << " takes a whole number, at least 1\n";
+                return false;
+            }
+        }
+        else {
+            if (!isParam(key)) {
+                std::cerr << path << ":" << lineNumber << ": unknown parameter " << key << "\n";
+                return false;
+            }
+            std::vector<double> values;
+            double value;
+            while (words >> value) {
+                if (!paramInRange(key, value)) {
+                    std::cerr << path << ":" << lineNumber << ": " << key << " takes " << paramRange(key) << "\n";
+                    return false;
+                }
+                values.push_back(value);
+            }
+            if (!readToEnd(words)) {
+                std::cerr << path << ":" << lineNumber << ": " << key << " takes numbers\n";
+                return false;
+            }
+            if (values.empty()) {
+                std::cerr << path << ":" << lineNumber << ": " << key << " has no values\n";
+                return false;
+            }
+            spec.axes.push_back({key, values});
+        }
+    }
+    if (spec.latinHypercube) {
+        if (spec.samples < 1) {
+            std::cerr << path << ": an lhs design needs samples\n";
+            return false;
+        }
+        for (const auto& axis : spec.axes) {
+            if (axis.second.size() != 2) {
+                std::cerr << path << ": lhs parameters take a min and a max (" << axis.first << ")\n";
+                return false;
+            }
+        }
+    }
+    if (spec.replicates < 1) {
+        std::cerr << path << ": replicates must be at least 1\n";
+        return false;
+    }
+    return true;
+}
+
+//the parameter points of a sweep, on top of the command line parameters
+std::vector<Params> sweepPoints(const SweepSpec& spec, const Params& base, std::uint64_t seed) {
+    std::vector<Params> points;
+    if (spec.latinHypercube) {
+        points.assign(spec.samples, base);
+        //one stratum per sample on every axis, strata matched up by an independent shuffle per axis
+        for (size_t axis (0); axis < spec.axes.size(); ++axis) {
+            const std::string& name = spec.axes[axis].first;
+            double low (spec.axes[axis].second[0]);
+            double high (spec.axes[axis].second[1]);
+            RandomStream rng (seed, 0, axis, Phase::Sweep);
+            std::vector<int> strata (spec.samples);
+            std::iota(strata.begin(), strata.end(), 0);
+            shuffleRange(strata.data(), strata.size(), rng);
+            for (int i (0); i < spec.samples; ++i) {
+                double value (low + (high - low) * (strata[i] + rng.uniform()) / spec.samples);
+                setParam(points[i], name, isIntegerParam(name) ? std::round(value) : value);
+            }
+        }
+    }
+    else {
+        points.push_back(base);
+        for (const auto& axis : spec.axes) {
+            std::vector<Params> expanded;
+            for (const Params& point : points) {
+                for (double value : axis.second) {
+                    Params next (point);
+                    setParam(next, axis.first, value);
+                    expanded.push_back(next);
                 }
             }
+            points.swap(expanded);
+        }
+    }
+    return points;
+}
+
+//SplitMix64 finaliser, to turn (seed, replicate) into a well-spread seed
+std::uint64_t mixSeed(std::uint64_t seed, std::uint64_t salt) {
+    std::uint64_t z (seed + 0x9E3779B97F4A7C15ull * (salt + 1));
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
 
-        pCoop /= (float) INITIAL_GROUPS;
-        avgTRate /= (float) INITIAL_GROUPS;
-        avgSRate /= (float) INITIAL_GROUPS;
+int runSweep(const SweepSpec& spec, const RunOptions& baseOptions, bool countEngine, int iterations,
+             const std::string& outputPrefix, ThreadPool& pool) {
+    std::vector<Params> points = sweepPoints(spec, baseOptions.params, baseOptions.seed);
+    size_t numJobs (points.size() * spec.replicates);
+    if (baseOptions.topology != nullptr) {
+        for (const Params& params : points) {
+            if ((size_t) params.initialGroups != baseOptions.topology->size()) {
+                std::cerr << "Every point of a sweep with a topology has to have its " << baseOptions.topology->size() << " groups\n";
+                return 1;
+            }
+        }
+    }
 
-        outf << j << "," << pCoop << "," << avgTRate << "," << avgSRate << "," << conflictChance[j] << std::endl;
+    std::ofstream index (outputPrefix + "_index.csv");
+    if (!index) {
+        std::cerr << "Couldn't write " << outputPrefix << "_index.csv\n";
+        return 1;
+    }
+    index << "Point,Replicate,Seed,Conflict Chance,Mutation Rate,Institution Chance,Groups,Agents,File\n";
+    std::vector<std::string> files (numJobs);
+    for (size_t job (0); job < numJobs; ++job) {
+        size_t point (job / spec.replicates);
+        size_t replicate (job % spec.replicates);
+        char name[64];
+        std::snprintf(name, sizeof(name), "_p%04zu_r%04zu.csv", point, replicate);
+        files[job] = outputPrefix + name;
+        const Params& params = points[point];
+        index << point << "," << replicate << "," << mixSeed(baseOptions.seed, replicate) << ","
+              << params.groupConflictChance << "," << params.individualMutationRate << ","
+              << params.institutionalChangeChance << "," << params.initialGroups << "," << params.agentsMultiplier << ","
+              << files[job] << "\n";
+    }
+    index.close();
+    std::cout << "Sweep: " << points.size() << " points x " << spec.replicates << " replicates" << std::endl;
 
+    /*
+    The jobs are what runs in parallel: each of the pool's cores takes the next job that hasn't started, one at a
+    time (jobs that stop early take very different times), and steps its world on its own. Once there are no
+    jobs left to start, the cores that come free go to the jobs still running.
+    */
+    std::atomic<int> failures (0);
+    std::atomic<size_t> nextJob (0);
+    CoreShare cores (pool.size());
+    std::vector<ConvergenceMonitor> monitors (numJobs, ConvergenceMonitor(baseOptions.precision, 0, 0));
+    pool.parallelFor(pool.size(), [&](size_t) {
+        for (size_t job (nextJob++); job < numJobs; job = nextJob++) {
+            RunOptions options (baseOptions);
+            options.params = points[job / spec.replicates];
+            options.seed = mixSeed(baseOptions.seed, job % spec.replicates);
+            ThreadPool inlinePool (1);
+            TrajectoryWriter writer (files[job], "", options.params.initialGroups, false, false, false, options.outputWindow > 0,
+                                     options.distributions);
+            if (!writer.ok()) {
+                ++failures;
+                continue;
+            }
+            RunControl control;
+            control.cores = &cores;
+            if (options.precision > 0) {
+                monitors[job] = ConvergenceMonitor(options.precision, options.params.individualMutationRate, options.minGenerations);
+                control.monitor = &monitors[job];
+            }
+            bool finished = withGroupType(countEngine, options.game, [&](auto type) {
+                return runSimulation<typename decltype(type)::type>(options, inlinePool, iterations, writer, CheckpointOptions(),
+                                                                    nullptr, control);
+            });
+            //a write that failed part way (a full disk) only shows once everything is flushed
+            writer.close();
+            if (!finished || !writer.ok()) {
+                std::cerr << "Sweep job " << files[job] << " failed\n";
+                ++failures;
+            }
         }
-        outf.close();
-        return 0;
+        cores.release();
+    });
+
+    if (failures > 0) {
+        std::cerr << failures << " sweep jobs failed or couldn't write their output\n";
+        return 1;
+    }
+    if (baseOptions.precision > 0) {
+        std::ofstream convergence (outputPrefix + "_convergence.csv");
+        convergence << "Point,Replicate,Generations,Stopped,Proportion of Cooperators,Half Width\n";
+        for (size_t job (0); job < numJobs; ++job) {
+            const ConvergenceMonitor& monitor = monitors[job];
+            convergence << job / spec.replicates << "," << job % spec.replicates << "," << monitor.getGenerations() << ","
+                        << STOP_REASON_NAMES[(int) monitor.getReason()] << ",";
+            if (!std::isnan(monitor.getEstimate())) {
+                convergence << monitor.getEstimate() << "," << monitor.getHalfWidth();
+            }
+            else {
+                convergence << ",";
+            }
+            convergence << "\n";
+        }
+        if (!convergence) {
+            std::cerr << "Couldn't write " << outputPrefix << "_convergence.csv\n";
+            return 1;
+        }
+    }
+    return 0;
+}
+
+#ifndef EVOSIM_NO_MAIN //other programs (the benchmarks) include this file for the model and bring their own main
+
+int main(int argc, char* argv[]) {
+    /*
+    Getting the main simulation up and running
+    */
+
+    //the whole run is a function of this one number, so pass --seed to reproduce a run
+    RunOptions options;
+    options.seed = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+    unsigned numThreads = std::max(1u, std::thread::hardware_concurrency()); //results don't depend on this
+    bool countEngine (false);
+    int iterations (1000); //how many times to repeat the simulation
+    std::string outputFile ("data.csv");
+    std::string trajectoryFile;
+    bool groupStates (false);
+    std::string sweepFile;
+    CheckpointOptions checkpoint;
+    std::string resumeFile;
+    std::string telemetryFile;
+    std::string traceFile;
+    unsigned numShards (1);
+    std::string topologySpec;
+    std::string topologyOrderFile;
+    std::string historyFile;
+
+    //says what's wrong with the command line and how it goes; main returns what this does
+    auto usage = [&](const std::string& problem) {
+        std::cerr << problem << "\nUsage: " << argv[0]
+                  << " [--generations N] [--seed N] [--threads N] [--shards N] [--output FILE] [--no-csv] [--sweep SPEC]\n"
+                  << "    [--trajectory FILE] [--group-states] [--export-csv TRAJECTORY CSV] [--history FILE] [--replay HISTORY GENERATION CSV]\n"
+                  << "    [--reproduction alias|binomial] [--engine agents|counts] [--game pd|loners|punishers] [--kernels auto|scalar]\n"
+                  << "    [--skip-ahead on|off] [--count-allocations] [--checkpoint FILE] [--checkpoint-every N] [--resume FILE]\n"
+                  << "    [--telemetry FILE] [--trace FILE] [--streaming] [--output-every N] [--output-window N] [--distributions]\n"
+                  << "    [--precision X] [--min-generations N] [--topology ring|lattice|FILE] [--topology-order FILE]\n"
+                  << "    [--conflict-chance X] [--mutation-rate X] [--institution-chance X] [--groups N] [--agents N]\n";
+        return 1;
+    };
+    const long long INT_LIMIT (std::numeric_limits<int>::max());
+
+    for (int a (1); a < argc; ++a) {
+        std::string arg (argv[a]);
+        std::string name (arg.size() > 2 ? arg.substr(2) : "");
+        if (arg == "--seed" && a + 1 < argc) {
+            if (!parseSeed(argv[++a], options.seed)) {
+                return usage(arg + " takes a whole number from 0 to " + std::to_string(std::numeric_limits<std::uint64_t>::max()));
+            }
+        }
+        else if (arg == "--threads" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 0, MAX_THREADS, numThreads)) {
+                return usage(arg + " takes a whole number of threads up to " + std::to_string(MAX_THREADS) + " (0 for all cores)");
+            }
+            if (numThreads == 0) {
+                numThreads = std::max(1u, std::thread::hardware_concurrency());
+            }
+        }
+        else if (arg == "--shards" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 1, MAX_SHARDS, numShards)) {
+                return usage(arg + " takes a whole number of shards, from 1 to " + std::to_string(MAX_SHARDS));
+            }
+        }
+        else if (arg == "--generations" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 1, INT_LIMIT, iterations)) {
+                return usage(arg + " takes a whole number of generations, at least 1");
+            }
+        }
+        else if (arg == "--output" && a + 1 < argc) {
+            outputFile = argv[++a];
+        }
+        else if (arg == "--no-csv") {
+            outputFile.clear();
+        }
+        else if (arg == "--trajectory" && a + 1 < argc) {
+            trajectoryFile = argv[++a];
+        }
+        else if (arg == "--group-states") {
+            groupStates = true;
+        }
+        else if (arg == "--export-csv" && a + 2 < argc) {
+            std::string binaryPath (argv[a + 1]);
+            std::string csvPath (argv[a + 2]);
+            return exportTrajectoryCsv(binaryPath, csvPath) ? 0 : 1;
+        }
+        else if (arg == "--history" && a + 1 < argc) {
+            historyFile = argv[++a];
+        }
+        else if (arg == "--replay" && a + 3 < argc) {
+            return replayHistory(argv[a + 1], argv[a + 2], argv[a + 3]) ? 0 : 1;
+        }
+        else if (arg == "--sweep" && a + 1 < argc) {
+            sweepFile = argv[++a];
+        }
+        else if (arg == "--reproduction" && a + 1 < argc) {
+            std::string mode (argv[++a]);
+            if (mode != "alias" && mode != "binomial") {
+                std::cerr << "--reproduction takes alias or binomial\n";
+                return 1;
+            }
+            options.reproductionMode = (mode == "binomial") ? ReproductionMode::Binomial : ReproductionMode::Alias;
+        }
+        else if (arg == "--count-allocations") {
+            options.countAllocations = true;
+        }
+        else if (arg == "--checkpoint" && a + 1 < argc) {
+            checkpoint.path = argv[++a];
+        }
+        else if (arg == "--checkpoint-every" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 1, INT_LIMIT, checkpoint.every)) {
+                return usage(arg + " takes a whole number of generations, at least 1");
+            }
+        }
+        else if (arg == "--resume" && a + 1 < argc) {
+            resumeFile = argv[++a];
+        }
+        else if (arg == "--streaming") {
+            options.streaming = true;
+        }
+        else if (arg == "--output-every" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 1, INT_LIMIT, options.outputEvery)) {
+                return usage(arg + " takes a whole number of generations, at least 1");
+            }
+        }
+        else if (arg == "--output-window" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 0, INT_LIMIT, options.outputWindow)) {
+                return usage(arg + " takes a whole number of generations (0 for none)");
+            }
+        }
+        else if (arg == "--distributions") {
+            options.distributions = true;
+        }
+        else if (arg == "--precision" && a + 1 < argc) {
+            if (!parseNumber(argv[++a], 0, 1, options.precision)) {
+                return usage(arg + " takes a half-width from 0 (don't stop early) to 1");
+            }
+        }
+        else if (arg == "--min-generations" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 0, INT_LIMIT, options.minGenerations)) {
+                return usage(arg + " takes a whole number of generations");
+            }
+        }
+        else if (arg == "--topology" && a + 1 < argc) {
+            topologySpec = argv[++a];
+        }
+        else if (arg == "--topology-order" && a + 1 < argc) {
+            topologyOrderFile = argv[++a];
+        }
+        else if (arg == "--telemetry" && a + 1 < argc) {
+            telemetryFile = argv[++a];
+        }
+        else if (arg == "--trace" && a + 1 < argc) {
+            traceFile = argv[++a];
+        }
+        else if (arg == "--kernels" && a + 1 < argc) {
+            std::string kernels (argv[++a]);
+            if (kernels != "auto" && kernels != "scalar") {
+                std::cerr << "--kernels takes auto or scalar\n";
+                return 1;
+            }
+            activeKernels = (kernels == "scalar") ? &SCALAR_KERNELS : chooseKernels();
+        }
+        else if (arg == "--game" && a + 1 < argc) {
+            std::string game (argv[++a]);
+            if (game != "pd" && game != "loners" && game != "punishers") {
+                std::cerr << "--game takes pd, loners or punishers\n";
+                return 1;
+            }
+            options.game = (game == "loners") ? GameKind::Loners : (game == "punishers") ? GameKind::Punishers : GameKind::PrisonersDilemma;
+        }
+        else if (arg == "--skip-ahead" && a + 1 < argc) {
+            std::string skip (argv[++a]);
+            if (skip != "on" && skip != "off") {
+                std::cerr << "--skip-ahead takes on or off\n";
+                return 1;
+            }
+            options.skipAhead = (skip == "on");
+        }
+        else if (arg == "--engine" && a + 1 < argc) {
+            std::string engine (argv[++a]);
+            if (engine != "agents" && engine != "counts") {
+                std::cerr << "--engine takes agents or counts\n";
+                return 1;
+            }
+            countEngine = (engine == "counts");
+        }
+        else if (a + 1 < argc && parseParamArgument(options.params, name, argv[a + 1])) {
+            ++a;
+        }
+        else {
+            return usage(isParam(name) ? arg + " takes " + paramRange(name) : "Unknown argument " + arg);
+        }
+    }
+    if (countEngine && options.game != GameKind::PrisonersDilemma) {
+        std::cerr << "The count engine only plays the prisoner's dilemma; use --engine agents for other games\n";
+        return 1;
+    }
+#if !EVOSIM_TELEMETRY
+    if (!telemetryFile.empty() || !traceFile.empty()) {
+        std::cerr << "This build has no telemetry; rebuild with -DEVOSIM_TELEMETRY=1 to use --telemetry or --trace\n";
+        return 1;
+    }
+#endif
+    if (!checkpoint.path.empty() && checkpoint.every <= 0) {
+        checkpoint.every = 100;
+    }
+    if (options.precision > 0 && (!checkpoint.path.empty() || !resumeFile.empty() || numShards > 1)) {
+        std::cerr << "--precision doesn't work with checkpoints or shards yet\n";
+        return 1;
+    }
+    if (!topologySpec.empty() && (!checkpoint.path.empty() || !resumeFile.empty() || numShards > 1)) {
+        std::cerr << "--topology doesn't work with checkpoints or shards yet\n";
+        return 1;
+    }
+    if (!historyFile.empty() && (!sweepFile.empty() || !resumeFile.empty() || numShards > 1)) {
+        std::cerr << "--history is for single runs from the start, not sweeps, resumed runs or shards\n";
+        return 1;
+    }
+
+    /*
+    A resumed run takes everything that decides the trajectory (seed, parameters, engine, run length) from the
+    snapshot rather than the command line, and cuts the output files back to where they were at the checkpoint.
+    */
+    std::unique_ptr<SnapshotFile> snapshot;
+    if (!resumeFile.empty()) {
+        snapshot = std::make_unique<SnapshotFile>(resumeFile);
+        if (!snapshot->error().empty()) {
+            std::cerr << "Can't resume from " << resumeFile << ": " << snapshot->error() << "\n";
+            return 1;
+        }
+        const SnapshotHeader& h = snapshot->header();
+        options.seed = h.seed;
+        options.reproductionMode = (ReproductionMode) h.reproductionMode;
+        options.params.groupConflictChance = h.groupConflictChance;
+        options.params.individualMutationRate = h.individualMutationRate;
+        options.params.institutionalChangeChance = h.institutionalChangeChance;
+        options.params.initialGroups = h.initialGroups;
+        options.params.agentsMultiplier = h.agentsMultiplier;
+        countEngine = h.countEngine != 0;
+        iterations = (int) h.iterations;
+        groupStates = h.groupStates != 0;
+        options.streaming = h.streaming != 0;
+        options.outputEvery = h.outputEvery;
+        options.outputWindow = h.outputWindow;
+        options.game = (GameKind) h.game;
+        options.skipAhead = h.skipAhead != 0;
+        options.distributions = h.distributions != 0;
+
+        std::pair<const std::string*, std::uint64_t> outputs[2] = {{&outputFile, h.csvBytes}, {&trajectoryFile, h.trajectoryBytes}};
+        for (auto [path, bytes] : outputs) {
+            if (path->empty()) {
+                continue;
+            }
+            std::error_code error;
+            std::uint64_t size (std::filesystem::file_size(*path, error));
+            if (error || size < bytes || bytes == 0) {
+                std::cerr << *path << " doesn't hold the output the checkpoint expects; use the same --output and --trajectory as the original run\n";
+                return 1;
+            }
+            std::filesystem::resize_file(*path, bytes);
+        }
+        std::cout << "Resuming at generation " << h.nextGeneration << " of " << iterations << std::endl;
+    }
+    std::cout << "Seed: " << options.seed << std::endl;
+
+    Topology topology;
+    if (!topologySpec.empty()) {
+        std::string error;
+        if (!makeTopology(topologySpec, (size_t) options.params.initialGroups, topology, error)) {
+            std::cerr << "Bad --topology: " << error << "\n";
+            return 1;
+        }
+        options.topology = &topology;
+        std::cout << "Topology: " << topology.kind;
+        if (topology.kind == "lattice") {
+            std::cout << " " << topology.width << "x" << topology.height;
+        }
+        std::cout << ", " << topology.neighbours.size() / 2 << " links" << std::endl;
+        if (!topologyOrderFile.empty()) {
+            std::ofstream order (topologyOrderFile);
+            order << "Group,Node\n";
+            for (size_t g (0); g < topology.size(); ++g) {
+                order << g << "," << topology.node[g] << "\n";
+            }
+            if (!order) {
+                std::cerr << "Couldn't write " << topologyOrderFile << "\n";
+                return 1;
+            }
+        }
+    }
+
+    if (numShards > 1) {
+        if (!sweepFile.empty() || !checkpoint.path.empty() || snapshot != nullptr || groupStates || options.countAllocations
+            || !telemetryFile.empty() || !traceFile.empty()) {
+            std::cerr << "Sharded runs don't do sweeps, checkpoints, group states, allocation counts or telemetry yet\n";
+            return 1;
+        }
+        if (numShards > (unsigned) options.params.initialGroups) {
+            std::cerr << "--shards takes no more shards than there are groups\n";
+            return 1;
+        }
+        return runShards(options, countEngine, iterations, numShards, numThreads, outputFile, trajectoryFile);
+    }
+
+    ThreadPool pool (numThreads);
+
+    if (!sweepFile.empty()) {
+        if (!telemetryFile.empty() || !traceFile.empty()) {
+            std::cerr << "Telemetry is for single runs, not sweeps\n";
+            return 1;
+        }
+        SweepSpec spec;
+        if (!parseSweepSpec(sweepFile, spec)) {
+            return 1;
+        }
+        if (spec.generations > 0) {
+            iterations = spec.generations;
+        }
+        //--output names the prefix of the sweep's files
+        std::string prefix (outputFile);
+        if (prefix.size() > 4 && prefix.compare(prefix.size() - 4, 4, ".csv") == 0) {
+            prefix.resize(prefix.size() - 4);
+        }
+        return runSweep(spec, options, countEngine, iterations, prefix, pool);
+    }
+
+    //define the file output stuff
+    TrajectoryWriter writer (outputFile, trajectoryFile, options.params.initialGroups, groupStates, true, snapshot != nullptr,
+                             options.outputWindow > 0, options.distributions);
+
+    if (!writer.ok()) {
+        std::cerr << "Well, cock. Some C++ nonsense means the file output didn't work.\n";
+        return 1;
+    }
+
+#if EVOSIM_TELEMETRY
+    std::unique_ptr<TelemetryRecorder> telemetry;
+    if (!telemetryFile.empty() || !traceFile.empty()) {
+        telemetry = std::make_unique<TelemetryRecorder>(telemetryFile, traceFile);
+        if (!telemetry->ok()) {
+            std::cerr << "Couldn't open the telemetry output\n";
+            return 1;
+        }
+        activeTelemetry = telemetry.get();
+    }
+#endif
+
+    ConvergenceMonitor monitor (options.precision, options.params.individualMutationRate, options.minGenerations);
+    RunControl control;
+    if (options.precision > 0) {
+        control.monitor = &monitor;
+    }
+    std::unique_ptr<HistoryRecorder> history;
+    if (!historyFile.empty()) {
+        history = std::make_unique<HistoryRecorder>(historyFile);
+        if (!history->ok()) {
+            std::cerr << "Couldn't open " << historyFile << "\n";
+            return 1;
+        }
+        control.history = history.get();
+    }
+    bool finished = withGroupType(countEngine, options.game, [&](auto type) {
+        return runSimulation<typename decltype(type)::type>(options, pool, iterations, writer, checkpoint, snapshot.get(), control);
+    });
+    if (finished && options.precision > 0) {
+        std::cout << "Stopped after " << monitor.getGenerations() << " generations (" << STOP_REASON_NAMES[(int) monitor.getReason()]
+                  << "): Proportion of Cooperators " << monitor.getEstimate() << " +/- " << monitor.getHalfWidth() << std::endl;
+    }
+
+    writer.close();
+    if (history && !history->close()) {
+        std::cerr << "Writing " << historyFile << " failed part way through\n";
+        finished = false;
+    }
+#if EVOSIM_TELEMETRY
+    if (telemetry) {
+        telemetry->close();
+        activeTelemetry = nullptr;
+    }
+#endif
+    if (!finished) {
+        return 1;
     }
+    if (!writer.ok()) {
+        std::cerr << "Writing the output failed part way through\n";
+        return 1;
+    }
+    return 0;
+}
+
+#endif //EVOSIM_NO_MAIN
@@ -0,0 +1,652 @@
+/*
+Differential validation of the engines against the reference. Builds against main_sim.cpp itself, like the
+benchmarks:
+
+    g++ -std=c++20 -O2 -pthread validate_sim.cpp -o evovalidate
+
+The reference is the per-agent engine as it was written first: every group goes through playWithinGroup and
+haveChildren (alias tables, no skip-ahead), conflicts through playGroupGame, with the plain scalar kernels.
+Everything faster (skip-ahead, binomial reproduction, the vector kernels, the count engine) claims to give the
+same distribution of runs from different random numbers, and this checks the claim: it runs the reference and
+each candidate over many seeds (disjoint ones, so the samples are independent) and compares the distributions
+of the world averages at a few checkpoints and over the second half of each run with two-sample
+Kolmogorov-Smirnov tests, and which institutions come to dominate and how cooperative worlds end up with
+chi-square tests. The significance level is split over a candidate's tests (Bonferroni), so a run of a correct
+engine passes with probability at least 1 - alpha.
+
+It also checks invariants that must hold exactly, on a mixed world at the start of every run and on the world
+it ends with: the tax pool gets paid out in full, reproduction keeps group sizes and (without mutation) brings
+in no strategy the parents don't play, and conflicts conserve agents and hand the winner's institutions to both
+sides. Before any of that it checks that the sharded runs' split of the group ids is consistent at every world
+size. It prints one CSV row per test and the candidate's throughput relative to the reference, and exits with
+an error if anything failed.
+*/
+
+#define EVOSIM_NO_MAIN
+#include "main_sim.cpp"
+
+const char* VALIDATE_HEADER = "candidate,check,statistic,p_value,threshold,result";
+
+struct ValidateOptions {
+    int seeds = 200; //runs per engine
+    int generations = 500;
+    int checkpoints = 4; //generations compared along the way, evenly spaced and ending with the last
+    double alpha = 0.01;
+    std::uint64_t seed = 1;
+};
+
+//an engine and its settings, as the command line would pick them
+struct Candidate {
+    std::string name;
+    bool countEngine;
+    bool skipAhead;
+    ReproductionMode reproductionMode;
+    const VectorKernels* kernels;
+};
+
+std::vector<Candidate> knownCandidates() {
+    return {{"skip-ahead", false, true, ReproductionMode::Alias, &SCALAR_KERNELS},
+            {"binomial", false, false, ReproductionMode::Binomial, &SCALAR_KERNELS},
+            {"kernels", false, false, ReproductionMode::Alias, chooseKernels()},
+            {"counts", true, false, ReproductionMode::Alias, &SCALAR_KERNELS},
+            {"program", false, true, ReproductionMode::Alias, chooseKernels()}}; //the command line's defaults
+}
+
+const Candidate REFERENCE = {"reference", false, false, ReproductionMode::Alias, &SCALAR_KERNELS};
+
+const int NUM_METRICS = 3;
+const char* METRIC_NAMES[NUM_METRICS] = {"coop", "tax_rate", "seg_rate"};
+const int COOP_BINS = 10;
+
+enum Invariant {
+    TAX_POOL_BALANCE,
+    CHILDREN_KEEP_SIZE,
+    NO_NEW_STRATEGIES,
+    CONFLICT_KEEPS_AGENTS,
+    CONFLICT_INSTITUTIONS,
+    NUM_INVARIANTS
+};
+
+const char* INVARIANT_NAMES[NUM_INVARIANTS] = {"tax_pool_balance", "children_keep_size", "no_new_strategies",
+                                               "conflict_keeps_agents", "conflict_institutions"};
+
+struct InvariantCounts {
+    std::uint64_t checked[NUM_INVARIANTS] = {};
+    std::uint64_t violated[NUM_INVARIANTS] = {};
+
+    void check(Invariant which, bool holds) {
+        ++checked[which];
+        if (!holds) {
+            ++violated[which];
+        }
+    }
+};
+
+//what one run contributes to the comparison
+struct RunSample {
+    std::vector<float> checkpoints; //checkpoint-major, NUM_METRICS per checkpoint
+    float means[NUM_METRICS] = {}; //over the second half of the run
+    int modalCell = 0; //the tax x segmentation cell with the most groups at the end
+    int coopBin = 0; //the final cooperator share, in tenths
+    double seconds = 0; //in the generation loop
+    std::uint64_t agentGenerations = 0;
+    InvariantCounts invariants;
+};
+
+/*
+Statistics. Two-sample Kolmogorov-Smirnov with the asymptotic p-value (with Stephens' small-sample correction,
+as in Numerical Recipes), and a chi-square test of homogeneity on two histograms.
+*/
+
+//P(D > observed) for the Kolmogorov distribution at lambda
+double kolmogorovTail(double lambda) {
+    if (lambda < 0.2) {
+        return 1;
+    }
+    double sum (0);
+    double sign (1);
+    for (int k (1); k <= 100; ++k) {
+        double term (sign * std::exp(-2 * (double) k * k * lambda * lambda));
+        sum += term;
+        if (std::abs(term) < 1e-12 * std::abs(sum)) {
+            break;
+        }
+        sign = -sign;
+    }
+    return std::clamp(2 * sum, 0.0, 1.0);
+}
+
+//returns the p-value and sets statistic to D; ties are stepped over together
+double ksTest(std::vector<double> a, std::vector<double> b, double& statistic) {
+    std::sort(a.begin(), a.end());
+    std::sort(b.begin(), b.end());
+    size_t i (0), k (0);
+    double d (0);
+    while (i < a.size() && k < b.size()) {
+        double x (std::min(a[i], b[k]));
+        while (i < a.size() && a[i] == x) {
+            ++i;
+        }
+        while (k < b.size() && b[k] == x) {
+            ++k;
+        }
+        d = std::max(d, std::abs((double) i / (double) a.size() - (double) k / (double) b.size()));
+    }
+    statistic = d;
+    double n (std::sqrt((double) a.size() * (double) b.size() / (double) (a.size() + b.size())));
+    return kolmogorovTail((n + 0.12 + 0.11 / n) * d);
+}
+
+//regularised upper incomplete gamma function Q(s, x), by its series below s + 1 and continued fraction above
+double upperGamma(double s, double x) {
+    if (x <= 0) {
+        return 1;
+    }
+    double logPrefix (s * std::log(x) - x - std::lgamma(s));
+    if (x < s + 1) {
+        double term (1 / s);
+        double sum (term);
+        for (int n (1); n < 1000 && std::abs(term) > 1e-15 * std::abs(sum); ++n) {
+            term *= x / (s + n);
+            sum += term;
+        }
+        return std::clamp(1 - sum * std::exp(logPrefix), 0.0, 1.0);
+    }
+    //modified Lentz
+    const double tiny (1e-300);
+    double b (x + 1 - s);
+    double c (1 / tiny);
+    double d (1 / b);
+    double h (d);
+    for (int n (1); n < 1000; ++n) {
+        double an (-n * (n - s));
+        b += 2;
+        d = an * d + b;
+        d = std::abs(d) < tiny ? tiny : d;
+        c = b + an / c;
+        c = std::abs(c) < tiny ? tiny : c;
+        d = 1 / d;
+        double delta (d * c);
+        h *= delta;
+        if (std::abs(delta - 1) < 1e-15) {
+            break;
+        }
+    }
+    return std::clamp(std::exp(logPrefix) * h, 0.0, 1.0);
+}
+
+/*
+Whether two histograms over the same cells come from the same distribution. Cells with fewer than 10 runs
+between the two are pooled into one, so that no expected count is tiny; with fewer than two cells left there's
+nothing to tell apart.
+*/
+double chiSquareTest(const std::vector<std::uint64_t>& a, const std::vector<std::uint64_t>& b, double& statistic) {
+    std::vector<std::uint64_t> cellsA, cellsB;
+    std::uint64_t pooledA (0), pooledB (0);
+    for (size_t c (0); c < a.size(); ++c) {
+        if (a[c] + b[c] >= 10) {
+            cellsA.push_back(a[c]);
+            cellsB.push_back(b[c]);
+        }
+        else {
+            pooledA += a[c];
+            pooledB += b[c];
+        }
+    }
+    if (pooledA + pooledB > 0) {
+        cellsA.push_back(pooledA);
+        cellsB.push_back(pooledB);
+    }
+    statistic = 0;
+    if (cellsA.size() < 2) {
+        return 1;
+    }
+    double totalA (0), totalB (0);
+    for (size_t c (0); c < cellsA.size(); ++c) {
+        totalA += (double) cellsA[c];
+        totalB += (double) cellsB[c];
+    }
+    for (size_t c (0); c < cellsA.size(); ++c) {
+        double both ((double) (cellsA[c] + cellsB[c]));
+        double expectedA (both * totalA / (totalA + totalB));
+        double expectedB (both * totalB / (totalA + totalB));
+        statistic += (cellsA[c] - expectedA) * (cellsA[c] - expectedA) / expectedA
+                     + (cellsB[c] - expectedB) * (cellsB[c] - expectedB) / expectedB;
+    }
+    return upperGamma(0.5 * (double) (cellsA.size() - 1), 0.5 * statistic);
+}
+
+/*
+Invariants. The phases are run on copies of the world's groups, so checking doesn't change the run.
+*/
+
+template <typename Game>
+void strategyCounts(const BasicGroup<Game>& group, std::vector<std::int64_t>& counts) {
+    counts.assign(Game::STRATEGIES, 0);
+    for (int c (0); c < Game::STRATEGIES; ++c) {
+        counts[c] = (std::int64_t) group.getAgents().countStrategy((Trait) c);
+    }
+}
+
+void strategyCounts(const CountGroup& group, std::vector<std::int64_t>& counts) {
+    counts = {group.numDefectors, group.numCooperators};
+}
+
+//everything the game paid out, before institution costs
+template <typename Game>
+double payoffSum(const BasicGroup<Game>& group) {
+    double total (0);
+    for (float payoff : group.getAgents().payoffs()) {
+        total += payoff;
+    }
+    return total;
+}
+
+double payoffSum(const CountGroup& group) {
+    return group.cooperatorPayoff + group.defectorPayoff;
+}
+
+std::int64_t sum(const std::vector<std::int64_t>& counts) {
+    return std::accumulate(counts.begin(), counts.end(), (std::int64_t) 0);
+}
+
+/*
+A world mid-run: the usual group sizes, spread-out institutions, and strategies mixed at random in three groups
+out of four and all the same in the rest, so that both the full phases and the skip-ahead get exercised.
+*/
+template <typename Game>
+void mixStrategies(BasicGroup<Game>& group, bool monomorphic, RandomStream& rng) {
+    Trait only ((Trait) rng.below(Game::STRATEGIES));
+    for (size_t i (0); i < group.getSize(); ++i) {
+        group.updateTraitByIndex(i, monomorphic ? only : (Trait) rng.below(Game::STRATEGIES));
+    }
+    group.updateComposition();
+}
+
+void mixStrategies(CountGroup& group, bool monomorphic, RandomStream& rng) {
+    std::int64_t size ((std::int64_t) group.getSize());
+    std::int64_t cooperators (monomorphic ? (rng.below(2) == 0 ? 0 : size) : drawBinomial(size, 0.5, rng));
+    group.setCounts(cooperators, size - cooperators);
+}
+
+template <typename GroupType>
+std::vector<GroupType> makeMixedWorld(const RunOptions& options) {
+    std::vector<GroupType> world = makeWorld<GroupType>(options);
+    for (GroupType& group : world) {
+        RandomStream rng (options.seed, 0, group.id, Phase::Sweep);
+        group.setInstitutions(rng.below(TAX_BINS) * 0.1f, rng.below(SEG_BINS) * 0.1f);
+        mixStrategies(group, rng.uniform() < 0.25f, rng);
+    }
+    return world;
+}
+
+template <typename GroupType>
+void checkInvariants(const std::vector<GroupType>& world, const RunOptions& options, int j, InvariantCounts& counts) {
+    RunOptions noMutation (options);
+    noMutation.params.individualMutationRate = 0;
+    std::vector<GroupType> played (world);
+    std::vector<std::int64_t> before, after;
+
+    for (size_t k (0); k < world.size(); ++k) {
+        //the same pairings with and without the tax: taxed, everyone played gets (1 + T) times their game payoff
+        GroupType taxed (world[k]);
+        GroupType untaxed (world[k]);
+        untaxed.setInstitutions(0, world[k].getSegRate());
+        RandomStream taxedRng (options.seed, j, k, Phase::Play);
+        RandomStream untaxedRng (options.seed, j, k, Phase::Play);
+        playWithinGroup(taxed, taxedRng);
+        playWithinGroup(untaxed, untaxedRng);
+        double expected ((1 + (double) world[k].getTaxRate()) * payoffSum(untaxed));
+        counts.check(TAX_POOL_BALANCE, std::abs(payoffSum(taxed) - expected) <= 1e-4 * std::max(1.0, std::abs(expected)));
+
+        //the candidate's own within-group phases, skip-ahead and all
+        strategyCounts(played[k], before);
+        RandomStream playRng (options.seed, j, k, Phase::Play);
+        RandomStream reproduceRng (options.seed, j, k, Phase::Reproduce);
+        playWithinPhases(played[k], playRng, reproduceRng, noMutation);
+        strategyCounts(played[k], after);
+        counts.check(CHILDREN_KEEP_SIZE, sum(after) == sum(before) && (std::int64_t) played[k].getSize() == sum(before));
+        bool newStrategy (false);
+        for (size_t c (0); c < before.size(); ++c) {
+            newStrategy = newStrategy || (before[c] == 0 && after[c] > 0);
+        }
+        counts.check(NO_NEW_STRATEGIES, !newStrategy);
+    }
+
+    //neighbours fight, now that they have payoffs to fight with
+    for (size_t k (0); k + 1 < played.size(); k += 2) {
+        GroupType& one = played[k];
+        GroupType& two = played[k + 1];
+        std::int64_t agents ((std::int64_t) (one.getSize() + two.getSize()));
+        const GroupType& winner = one.getTotalPayoff() >= two.getTotalPayoff() ? one : two;
+        float taxRate (winner.getTaxRate());
+        float segRate (winner.getSegRate());
+        RandomStream conflictRng (options.seed, j, k / 2, Phase::Conflict);
+        playGroupGame(one, two, conflictRng);
+        strategyCounts(one, before);
+        strategyCounts(two, after);
+        counts.check(CONFLICT_KEEPS_AGENTS, sum(before) + sum(after) == agents && sum(before) >= GROUP_SIZE_LOWER_BOUND
+                                                && sum(after) >= GROUP_SIZE_LOWER_BOUND);
+        counts.check(CONFLICT_INSTITUTIONS, one.getTaxRate() == taxRate && two.getTaxRate() == taxRate
+                                                && one.getSegRate() == segRate && two.getSegRate() == segRate);
+    }
+}
+
+/*
+One run: the invariants on a mixed world, then the run itself from the usual start, sampled as it goes, then
+the invariants again on where it ended up.
+*/
+template <typename GroupType>
+RunSample runSample(const RunOptions& options, const ValidateOptions& validate) {
+    RunSample sample;
+    checkInvariants(makeMixedWorld<GroupType>(options), options, validate.generations, sample.invariants);
+
+    ThreadPool inlinePool (1);
+    std::vector<GroupType> world = makeWorld<GroupType>(options);
+    WorldStatistics statistics;
+    statistics.rebuild(world);
+    ConflictChanceSeries conflictChance (options.seed, validate.generations, options.params.groupConflictChance, false);
+    for (const GroupType& group : world) {
+        sample.agentGenerations += group.getSize();
+    }
+    sample.agentGenerations *= (std::uint64_t) validate.generations; //conflict and reproduction both keep the total
+
+    sample.checkpoints.resize((size_t) validate.checkpoints * NUM_METRICS);
+    int nextCheckpoint (0);
+    int halfway (validate.generations / 2);
+    WorldStats stats;
+    auto start = std::chrono::steady_clock::now();
+    for (int j (0); j < validate.generations; ++j) {
+        stats = runGeneration(world, j, conflictChance[j], options, inlinePool, statistics);
+        float values[NUM_METRICS] = {stats.pCoop, stats.avgTRate, stats.avgSRate};
+        if (j >= halfway) {
+            for (int m (0); m < NUM_METRICS; ++m) {
+                sample.means[m] += values[m] / (float) (validate.generations - halfway);
+            }
+        }
+        if (nextCheckpoint < validate.checkpoints
+            && j + 1 == (int) ((std::int64_t) validate.generations * (nextCheckpoint + 1) / validate.checkpoints)) {
+            std::copy(values, values + NUM_METRICS, sample.checkpoints.begin() + nextCheckpoint * NUM_METRICS);
+            ++nextCheckpoint;
+        }
+    }
+    sample.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    WorldDistribution distribution;
+    statistics.distribution(distribution);
+    sample.modalCell = (int) (std::max_element(std::begin(distribution.institutions), std::end(distribution.institutions))
+                              - std::begin(distribution.institutions));
+    sample.coopBin = std::min(COOP_BINS - 1, (int) (stats.pCoop * COOP_BINS));
+
+    checkInvariants(world, options, validate.generations + 1, sample.invariants);
+    return sample;
+}
+
+//all of an engine's runs; the reference gets the even seeds and the candidates the odd ones
+std::vector<RunSample> runEngine(const Candidate& engine, const RunOptions& baseOptions, const ValidateOptions& validate,
+                                 std::uint64_t salt, ThreadPool& pool) {
+    activeKernels = engine.kernels; //the kernels are global, so engines run one after the other
+    std::vector<RunSample> samples (validate.seeds);
+    pool.parallelFor(samples.size(), [&](size_t i) {
+        RunOptions options (baseOptions);
+        options.seed = mixSeed(validate.seed, 2 * i + salt);
+        options.skipAhead = engine.skipAhead;
+        options.reproductionMode = engine.reproductionMode;
+        samples[i] = withGroupType(engine.countEngine, options.game, [&](auto type) {
+            return runSample<typename decltype(type)::type>(options, validate);
+        });
+    });
+    activeKernels = chooseKernels();
+    return samples;
+}
+
+struct CheckResult {
+    std::string check;
+    double statistic;
+    double pValue; //negative for checks that aren't tests
+    double threshold;
+    bool passed;
+};
+
+std::vector<CheckResult> compare(const std::vector<RunSample>& reference, const std::vector<RunSample>& candidate,
+                                 const ValidateOptions& validate) {
+    std::vector<CheckResult> results;
+    auto ks = [&](const std::string& name, auto&& value) {
+        std::vector<double> a, b;
+        for (const RunSample& sample : reference) {
+            a.push_back(value(sample));
+        }
+        for (const RunSample& sample : candidate) {
+            b.push_back(value(sample));
+        }
+        CheckResult result {"ks_" + name, 0, 0, 0, false};
+        result.pValue = ksTest(a, b, result.statistic);
+        results.push_back(result);
+    };
+    for (int c (0); c < validate.checkpoints; ++c) {
+        int generation ((int) ((std::int64_t) validate.generations * (c + 1) / validate.checkpoints));
+        for (int m (0); m < NUM_METRICS; ++m) {
+            ks(std::string(METRIC_NAMES[m]) + "_g" + std::to_string(generation),
+               [&](const RunSample& sample) { return (double) sample.checkpoints[c * NUM_METRICS + m]; });
+        }
+    }
+    for (int m (0); m < NUM_METRICS; ++m) {
+        ks(std::string(METRIC_NAMES[m]) + "_mean", [&](const RunSample& sample) { return (double) sample.means[m]; });
+    }
+
+    auto chiSquare = [&](const std::string& name, size_t cells, auto&& cell) {
+        std::vector<std::uint64_t> a (cells), b (cells);
+        for (const RunSample& sample : reference) {
+            ++a[cell(sample)];
+        }
+        for (const RunSample& sample : candidate) {
+            ++b[cell(sample)];
+        }
+        CheckResult result {"chi2_" + name, 0, 0, 0, false};
+        result.pValue = chiSquareTest(a, b, result.statistic);
+        results.push_back(result);
+    };
+    chiSquare("modal_institutions", TAX_BINS * SEG_BINS, [](const RunSample& sample) { return (size_t) sample.modalCell; });
+    chiSquare("final_coop", COOP_BINS, [](const RunSample& sample) { return (size_t) sample.coopBin; });
+
+    double threshold (validate.alpha / (double) results.size());
+    for (CheckResult& result : results) {
+        result.threshold = threshold;
+        result.passed = result.pValue >= threshold;
+    }
+
+    InvariantCounts invariants;
+    for (const RunSample& sample : candidate) {
+        for (int i (0); i < NUM_INVARIANTS; ++i) {
+            invariants.checked[i] += sample.invariants.checked[i];
+            invariants.violated[i] += sample.invariants.violated[i];
+        }
+    }
+    for (int i (0); i < NUM_INVARIANTS; ++i) {
+        results.push_back({INVARIANT_NAMES[i], (double) invariants.violated[i], -1, 0, invariants.violated[i] == 0});
+    }
+    return results;
+}
+
+/*
+Sharded runs split the group ids into ranges with shardFirst and find an id's shard again with shardOf, and the
+shards fall out of step if the two ever disagree. They have to agree at every boundary for every shard count and
+world size the command line takes, including worlds far bigger than anything run here.
+*/
+std::uint64_t shardRangeViolations() {
+    std::uint64_t violations (0);
+    for (std::uint64_t numGroups : {1ull, 100ull, 4097ull, 70000000ull, (unsigned long long) std::numeric_limits<int>::max()}) {
+        for (unsigned numShards (1); numShards <= MAX_SHARDS && numShards <= numGroups; ++numShards) {
+            for (unsigned shard (0); shard < numShards; ++shard) {
+                size_t first (shardFirst(numGroups, numShards, shard));
+                size_t last (shardFirst(numGroups, numShards, shard + 1));
+                if (first >= last || shardOf(first, numGroups, numShards) != shard || shardOf(last - 1, numGroups, numShards) != shard) {
+                    ++violations;
+                }
+            }
+        }
+    }
+    return violations;
+}
+
+//agent-generations per second of CPU time, over all of an engine's runs
+double throughput(const std::vector<RunSample>& samples) {
+    double seconds (0), agentGenerations (0);
+    for (const RunSample& sample : samples) {
+        seconds += sample.seconds;
+        agentGenerations += (double) sample.agentGenerations;
+    }
+    return seconds > 0 ? agentGenerations / seconds : 0;
+}
+
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::stringstream stream (text);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        items.push_back(item);
+    }
+    return items;
+}
+
+int main(int argc, char* argv[]) {
+    ValidateOptions validate;
+    RunOptions options;
+    options.params.initialGroups = 50;
+    unsigned numThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::string> names {"skip-ahead", "binomial", "kernels", "counts"};
+    std::string outputFile;
+
+    //says what's wrong with the command line and how it goes; main returns what this does
+    auto usage = [&](const std::string& problem) {
+        std::cerr << problem << "\nUsage: " << argv[0]
+                  << " [--candidate skip-ahead,binomial,kernels,counts,program] [--seeds N] [--generations N]\n"
+                  << "    [--checkpoints N] [--alpha X] [--seed N] [--threads N] [--game pd|loners|punishers]\n"
+                  << "    [--conflict-chance X] [--mutation-rate X] [--institution-chance X] [--groups N] [--agents N]\n"
+                  << "    [--output FILE]\n";
+        return 1;
+    };
+    const long long INT_LIMIT (std::numeric_limits<int>::max());
+
+    for (int a (1); a < argc; ++a) {
+        std::string arg (argv[a]);
+        std::string name (arg.size() > 2 ? arg.substr(2) : "");
+        if (arg == "--candidate" && a + 1 < argc) {
+            names = splitList(argv[++a]);
+        }
+        else if (arg == "--seeds" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 2, INT_LIMIT, validate.seeds)) {
+                return usage(arg + " takes a whole number of seeds, at least 2");
+            }
+        }
+        else if (arg == "--generations" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 2, INT_LIMIT, validate.generations)) {
+                return usage(arg + " takes a whole number of generations, at least 2");
+            }
+        }
+        else if (arg == "--checkpoints" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 1, INT_LIMIT, validate.checkpoints)) {
+                return usage(arg + " takes a whole number of checkpoints, at least 1");
+            }
+        }
+        else if (arg == "--alpha" && a + 1 < argc) {
+            if (!parseNumber(argv[++a], 0, 1, validate.alpha)) {
+                return usage(arg + " takes a significance level from 0 to 1");
+            }
+        }
+        else if (arg == "--seed" && a + 1 < argc) {
+            if (!parseSeed(argv[++a], validate.seed)) {
+                return usage(arg + " takes a whole number from 0 to " + std::to_string(std::numeric_limits<std::uint64_t>::max()));
+            }
+        }
+        else if (arg == "--threads" && a + 1 < argc) {
+            if (!parseInteger(argv[++a], 0, MAX_THREADS, numThreads)) {
+                return usage(arg + " takes a whole number of threads up to " + std::to_string(MAX_THREADS) + " (0 for all cores)");
+            }
+            if (numThreads == 0) {
+                numThreads = std::max(1u, std::thread::hardware_concurrency());
+            }
+        }
+        else if (arg == "--game" && a + 1 < argc) {
+            std::string game (argv[++a]);
+            if (game != "pd" && game != "loners" && game != "punishers") {
+                std::cerr << "Unknown game " << game << "\n";
+                return 1;
+            }
+            options.game = game == "loners" ? GameKind::Loners : game == "punishers" ? GameKind::Punishers : GameKind::PrisonersDilemma;
+        }
+        else if (arg == "--output" && a + 1 < argc) {
+            outputFile = argv[++a];
+        }
+        else if (a + 1 < argc && parseParamArgument(options.params, name, argv[a + 1])) {
+            ++a;
+        }
+        else {
+            return usage(isParam(name) ? arg + " takes " + paramRange(name) : "Unknown argument " + arg);
+        }
+    }
+    if (validate.seeds < 2 || validate.generations < 2 || validate.checkpoints < 1 || validate.checkpoints > validate.generations) {
+        std::cerr << "Need at least 2 seeds and 2 generations, and between 1 and --generations checkpoints\n";
+        return 1;
+    }
+
+    std::vector<Candidate> candidates;
+    std::vector<Candidate> known (knownCandidates());
+    for (const std::string& name : names) {
+        auto found = std::find_if(known.begin(), known.end(), [&](const Candidate& c) { return c.name == name; });
+        if (found == known.end()) {
+            std::cerr << "Unknown candidate " << name << "\n";
+            return 1;
+        }
+        if (found->countEngine && options.game != GameKind::PrisonersDilemma) {
+            std::cerr << "Skipping counts: the count engine only plays the prisoner's dilemma\n";
+            continue;
+        }
+        candidates.push_back(*found);
+    }
+
+    std::ofstream file;
+    if (!outputFile.empty()) {
+        file.open(outputFile);
+        if (!file) {
+            std::cerr << "Couldn't write " << outputFile << "\n";
+            return 1;
+        }
+    }
+    std::ostream& out = outputFile.empty() ? std::cout : file;
+    out << VALIDATE_HEADER << "\n";
+
+    int failures (0);
+    std::uint64_t shardViolations (shardRangeViolations());
+    out << "sharding,shard_ranges," << shardViolations << ",,0," << (shardViolations == 0 ? "pass" : "FAIL") << "\n";
+    if (shardViolations > 0) {
+        std::cerr << "sharding: FAIL (" << shardViolations << " shard ranges don't map back to their shard)\n";
+        ++failures;
+    }
+
+    ThreadPool pool (numThreads);
+    std::vector<RunSample> reference = runEngine(REFERENCE, options, validate, 0, pool);
+    double referenceThroughput (throughput(reference));
+
+    for (const Candidate& candidate : candidates) {
+        std::vector<RunSample> samples = runEngine(candidate, options, validate, 1, pool);
+        std::vector<CheckResult> results = compare(reference, samples, validate);
+        int failed (0);
+        for (const CheckResult& result : results) {
+            out << candidate.name << "," << result.check << "," << result.statistic << ",";
+            if (result.pValue >= 0) {
+                out << result.pValue;
+            }
+            out << "," << result.threshold << "," << (result.passed ? "pass" : "FAIL") << "\n";
+            failed += result.passed ? 0 : 1;
+        }
+        double ratio (referenceThroughput > 0 ? throughput(samples) / referenceThroughput : 0);
+        out << candidate.name << ",throughput_ratio," << ratio << ",,,\n";
+        out.flush();
+        std::cerr << candidate.name << ": " << (failed == 0 ? "PASS" : "FAIL") << " (" << failed << " of " << results.size()
+                  << " checks failed), " << ratio << "x the reference's agent-generations per second ("
+                  << (candidate.kernels == &SCALAR_KERNELS ? "scalar" : candidate.kernels->name) << " kernels)\n";
+        failures += failed;
+    }
+    return failures > 0 ? 1 : 0;
+}